@@ -37,6 +37,8 @@
 #include "config.h"
 
 #include "debug.h"
+#include "fft.h"
+#include "smoothing.h"
 #include "util.h"
 
 #include "output/raw.h"
@@ -60,7 +62,6 @@
 #define GCC_UNUSED /* nothing */
 #endif
 
-pthread_mutex_t lock;
 // used by sig handler
 // needs to know output mode in order to clean up terminal
 int output_mode;
@@ -75,13 +76,6 @@ int should_quit = 0;
 // will allow us to not free them on exit without ASan complaining
 struct config_params p;
 
-fftw_complex *out_bass_l, *out_bass_r;
-fftw_plan p_bass_l, p_bass_r;
-fftw_complex *out_mid_l, *out_mid_r;
-fftw_plan p_mid_l, p_mid_r;
-fftw_complex *out_treble_l, *out_treble_r;
-fftw_plan p_treble_l, p_treble_r;
-
 // general: cleanup
 void cleanup(void) {
 	if (output_mode == OUTPUT_NCURSES) {
@@ -138,41 +132,496 @@ static bool directory_exists(const char *path) {
 
 #endif
 
-int *monstercat_filter(int *bars, int number_of_bars, int waves, double monstercat) {
+// one frame of bars, as handed from the DSP thread to the renderer
+struct bar_frame {
+	// CLOCK_MONOTONIC, when the newest audio in it was playing. that is when the
+	// DSP thread finished it, less the latency the input reported for its capture.
+	struct timespec time;
+	unsigned long sequence;
+	int number_of_bars;
+	int bars[MAX_BARS];
+};
+
+// single-slot mailbox between the DSP thread and the renderer, built as a
+// triple buffer so neither side ever waits for the other. the writer fills its
+// back frame and swaps it into the middle, the reader swaps the middle for its
+// front frame only when a new one was posted. a frame that is not taken in
+// time is overwritten, the renderer always gets the newest one.
+#define MAILBOX_FRESH 4
+
+struct bar_mailbox {
+	struct bar_frame frames[3];
+	int middle; // frame index, or'ed with MAILBOX_FRESH until it is taken
+	int back;   // writer only
+	int front;  // reader only
+};
+
+static void mailbox_init(struct bar_mailbox *mailbox) {
+	mailbox->back = 0;
+	mailbox->middle = 1;
+	mailbox->front = 2;
+}
+
+static struct bar_frame *mailbox_back(struct bar_mailbox *mailbox) {
+	return &mailbox->frames[mailbox->back];
+}
+
+static void mailbox_post(struct bar_mailbox *mailbox) {
+	int old = __atomic_exchange_n(&mailbox->middle, mailbox->back | MAILBOX_FRESH,
+			__ATOMIC_ACQ_REL);
+	mailbox->back = old & ~MAILBOX_FRESH;
+}
+
+// the newest frame, or NULL when nothing was posted since the last call
+static const struct bar_frame *mailbox_take(struct bar_mailbox *mailbox) {
+	if (!(__atomic_load_n(&mailbox->middle, __ATOMIC_RELAXED) & MAILBOX_FRESH))
+		return NULL;
+	int old = __atomic_exchange_n(&mailbox->middle, mailbox->front, __ATOMIC_ACQ_REL);
+	mailbox->front = old & ~MAILBOX_FRESH;
+	return &mailbox->frames[mailbox->front];
+}
+
+static double elapsed_ms(const struct timespec *from, const struct timespec *to) {
+	return (to->tv_sec - from->tv_sec) * 1e3 + (to->tv_nsec - from->tv_nsec) / 1e6;
+}
+
+// milliseconds since *since, which is moved up to now
+static double lap_ms(struct timespec *since) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	double ms = elapsed_ms(since, &now);
+	*since = now;
+	return ms;
+}
+
+// sleeps until one period after *deadline and moves it there. a thread that
+// fell behind starts over from now instead of racing to catch up.
+static void wait_for_next_frame(struct timespec *deadline, long period_nsec) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	deadline->tv_nsec += period_nsec;
+	deadline->tv_sec += deadline->tv_nsec / 1000000000;
+	deadline->tv_nsec %= 1000000000;
+	if (elapsed_ms(&now, deadline) < 0)
+		*deadline = now;
+#ifdef HAVE_CLOCK_NANOSLEEP
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, deadline, NULL) == EINTR)
+		;
+#else
+	// macOS has no absolute sleep, sleep for what is left of the period instead
+	struct timespec left = {deadline->tv_sec - now.tv_sec, deadline->tv_nsec - now.tv_nsec};
+	if (left.tv_nsec < 0) {
+		left.tv_nsec += 1000000000;
+		left.tv_sec--;
+	}
+	while (nanosleep(&left, &left) == -1 && errno == EINTR)
+		;
+#endif
+}
+
+// counting semaphore for pacing the export. unnamed POSIX semaphores are not
+// implemented on macOS, so it is built like the input pacing.
+struct semaphore {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	unsigned int count;
+};
+
+static void semaphore_init(struct semaphore *sem, unsigned int count) {
+	pthread_mutex_init(&sem->lock, NULL);
+	pthread_cond_init(&sem->cond, NULL);
+	sem->count = count;
+}
+
+static void semaphore_destroy(struct semaphore *sem) {
+	pthread_mutex_destroy(&sem->lock);
+	pthread_cond_destroy(&sem->cond);
+}
+
+static void semaphore_post(struct semaphore *sem) {
+	pthread_mutex_lock(&sem->lock);
+	sem->count++;
+	pthread_cond_signal(&sem->cond);
+	pthread_mutex_unlock(&sem->lock);
+}
+
+static void semaphore_wait(struct semaphore *sem) {
+	pthread_mutex_lock(&sem->lock);
+	while (sem->count == 0)
+		pthread_cond_wait(&sem->cond, &sem->lock);
+	sem->count--;
+	pthread_mutex_unlock(&sem->lock);
+}
+
+// the smoothing was tuned at this many frames per second. falloff, integral and
+// autosens advance by the measured time between frames in units of these, so
+// they look the same at any frame rate and catch up after a late frame.
+#define SMOOTHING_HZ 60
+// the most a single frame advances them, after sleep mode or a stall the bars
+// carry on from where they were instead of jumping
+#define SMOOTHING_MAX_STEPS 15
+
+// smoothing state of every bar, one float array per quantity so each stage is
+// a straight pass the compiler vectorizes
+struct bar_state {
+	int source[MAX_BARS]; // index of each bar in the channel bars, for mirroring and reverse
+	float value[MAX_BARS];
+	float last[MAX_BARS];
+	float peak[MAX_BARS];
+	float fall[MAX_BARS];
+	float mem[MAX_BARS];
+};
+
+// where each bar on screen comes from. the right channel's bars start
+// MAX_BARS after the left one's.
+static void bar_state_init(struct bar_state *s, int number_of_bars, bool stereo, bool reverse) {
+	memset(s, 0, sizeof(*s));
+	int half = number_of_bars / 2;
+	for (int n = 0; n < number_of_bars; n++) {
+		if (stereo) {
+			if (n < half)
+				s->source[n] = reverse ? n : half - n - 1;
+			else
+				s->source[n] = MAX_BARS + (reverse ? number_of_bars - n - 1 : n - half);
+		} else {
+			s->source[n] = reverse ? number_of_bars - 1 - n : n;
+		}
+	}
+}
+
+static void bars_gather(struct bar_state *restrict s, const int *restrict channels, int count) {
+	for (int n = 0; n < count; n++)
+		s->value[n] = channels[s->source[n]];
+}
+
+// four bars per operation, the width SSE2 and NEON have natively. wider types
+// get split up and spilled on those. the falloff and integral passes choose
+// per bar, which gcc does not if-convert on its own, so they select through a
+// mask. they run in whole vectors, the arrays are MAX_BARS long and MAX_BARS is
+// a multiple of the width.
+typedef float vfloat __attribute__((vector_size(16)));
+typedef int32_t vmask __attribute__((vector_size(16)));
+#define VFLOAT_WIDTH ((int)(sizeof(vfloat) / sizeof(float)))
+#define VSELECT(mask, a, b) ((vfloat)(((mask) & (vmask)(a)) | (~(mask) & (vmask)(b))))
+
+// a bar that drops below where it was falls from its peak by g * t^2 instead
+static void bars_falloff(struct bar_state *restrict s, int count, float g, float steps) {
+	const vfloat zero = {0};
+	for (int n = 0; n < count; n += VFLOAT_WIDTH) {
+		vfloat value, last, peak, fall;
+		memcpy(&value, s->value + n, sizeof(value));
+		memcpy(&last, s->last + n, sizeof(last));
+		memcpy(&peak, s->peak + n, sizeof(peak));
+		memcpy(&fall, s->fall + n, sizeof(fall));
+
+		vfloat dropped = peak - g * fall * fall;
+		dropped = VSELECT(dropped > zero, dropped, zero);
+		vmask falling = value < last;
+		value = VSELECT(falling, dropped, value);
+		peak = VSELECT(falling, peak, value);
+		fall = VSELECT(falling, fall + steps, zero);
+
+		memcpy(s->value + n, &value, sizeof(value));
+		memcpy(s->last + n, &value, sizeof(value));
+		memcpy(s->peak + n, &peak, sizeof(peak));
+		memcpy(s->fall + n, &fall, sizeof(fall));
+	}
+}
+
+// leaky integration, the memory of a bar at the top is let go a little faster
+static void bars_integral(struct bar_state *restrict s, int count, float decay, float gain,
+		float height) {
+	for (int n = 0; n < count; n += VFLOAT_WIDTH) {
+		vfloat value, mem;
+		memcpy(&value, s->value + n, sizeof(value));
+		memcpy(&mem, s->mem + n, sizeof(mem));
+
+		value = mem * decay + value * gain;
+		mem = VSELECT(value >= height, value * (1 - 1 / 20.0f), value);
+
+		memcpy(s->value + n, &value, sizeof(value));
+		memcpy(s->mem + n, &mem, sizeof(mem));
+	}
+}
+
+// clamps every bar to at least 'lowest' and writes them out as integers.
+// returns how many are above 'height', for autosens.
+static int bars_output(const struct bar_state *restrict s, int count, float lowest, float height,
+		int *restrict out) {
+	int over = 0;
+	for (int n = 0; n < count; n++) {
+		float v = s->value[n] > lowest ? s->value[n] : lowest;
+		over += v > height;
+		out[n] = v;
+	}
+	return over;
+}
+
+// the analysis of one layout. main sets it up, starts the DSP thread on it and
+// leaves everything but the flags and the mailbox alone until it joined again.
+struct dsp {
+	struct audio_data *audio;
+	struct fft_bands *bands;
+	const struct bar_table *bar_table;
+	sample_t *temp_l, *temp_r;
+	int *bars_left, *bars_right;
+	int number_of_bars, height;
+	float g; // falloff per SMOOTHING_HZ frame squared
+	double integral;
+	long frame_nsec;
+	bool first; // autosens is still looking for the level
+
+	// offline export. every frame takes exactly one frame of input at the
+	// framerate and is drawn before the next one is made, as fast as that goes.
+	// drawn is posted by main once it rendered a frame, posted by us for every
+	// frame and once more on the way out.
+	bool paced;
+	struct semaphore posted, drawn;
+
+	struct bar_mailbox mailbox;
+	int stop;     // set by main
+	int relayout; // the input changed its rate, main plans for it and rebuilds the tables
+	int quit;     // draw_and_quit frames are done
+	int total_bar_height;
+
+	// debug readings, printed by main since ncurses is not ours to call
+	int min_value, max_value;
+	double sens;
+	unsigned long naps; // sleep mode pauses, one a second
+
+	// stage timing, summed over all frames
+	unsigned long frames;
+	double prepare_ms, fft_ms, bars_ms, smoothing_ms;
+};
+
+// produces a frame of bars every frame_nsec until main stops it or the input
+// changes its rate. when paced, one for every frame of input instead, each once
+// main drew the last.
+static void *dsp_thread(void *data) {
+	struct dsp *dsp = data;
+	struct audio_data *audio = dsp->audio;
+	struct fft_bands *bands = dsp->bands;
+	int number_of_bars = dsp->number_of_bars;
+	int height = dsp->height;
+	float g = dsp->g;
+	sample_t *temp_l = dsp->temp_l, *temp_r = dsp->temp_r;
+	int *bars_left = dsp->bars_left, *bars_right = dsp->bars_right;
+
+	int bars[MAX_BARS] = {0};
+	struct bar_state state;
+	bar_state_init(&state, number_of_bars, p.stereo, p.reverse);
+
+	bool silence = false;
+	int total_frames = 0;
+	unsigned long sequence = 0;
+
+#ifndef NDEBUG
+	int maxvalue = 0;
+	int minvalue = 0;
+#endif
+
+	struct timespec sleep_mode_timer = {.tv_sec = 1, .tv_nsec = 0};
+	struct timespec deadline, stage, last_frame;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	bool have_last_frame = false;
+	double steps;
+
+	// paced input is counted from where the last layout left it
+	uint64_t paced_start = __atomic_load_n(&audio->write_index, __ATOMIC_ACQUIRE);
+
+	while (!__atomic_load_n(&dsp->stop, __ATOMIC_ACQUIRE)) {
+		// process: planning for a new rate and rebuilding the bin tables is up
+		// to main, hand back and let it restart us on the new layout
+		unsigned int rate = __atomic_load_n(&audio->rate, __ATOMIC_RELAXED);
+		if (rate && rate != bands->rate) {
+			__atomic_store_n(&dsp->relayout, 1, __ATOMIC_RELEASE);
+			break;
+		}
+
+		// process: when paced, wait for main to draw the last frame and then for
+		// the input of this one. the end of the input is the end of the export.
+		if (dsp->paced) {
+			semaphore_wait(&dsp->drawn);
+			if (__atomic_load_n(&dsp->stop, __ATOMIC_ACQUIRE))
+				break;
+
+			uint64_t end = paced_start + (uint64_t)(sequence + 1) * rate / p.framerate;
+			if (!input_wait_for(audio, end)) {
+				if (!audio->terminate)
+					__atomic_store_n(&dsp->quit, 1, __ATOMIC_RELEASE);
+				break;
+			}
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &stage);
+
+		// process [smoothing]: time since the last frame, in frames of SMOOTHING_HZ.
+		// paced frames are apart by the time of their input, however long they took.
+		if (have_last_frame && !dsp->paced)
+			steps = elapsed_ms(&last_frame, &stage) * SMOOTHING_HZ / 1000;
+		else
+			steps = SMOOTHING_HZ * (dsp->frame_nsec / 1e9);
+		if (steps > SMOOTHING_MAX_STEPS)
+			steps = SMOOTHING_MAX_STEPS;
+		last_frame = stage;
+		have_last_frame = true;
+
+		// the integral filter takes 'steps' frames at once. scaling the new
+		// input keeps its steady state that of one frame at a time.
+		double integral_decay = pow(dsp->integral, steps);
+		double integral_gain =
+			dsp->integral < 1 ? (1 - integral_decay) / (1 - dsp->integral) : steps;
+
+		// process: window the newest samples of each band into the FFT inputs.
+		// when nothing new came in, or the copy was torn, the spectrum of the
+		// last frame still stands and the FFT is skipped.
+		bool fresh = prepare_fftw_input_buffers(audio);
+
+		// process: check if input is present, from the level the input thread keeps
+		silence = input_is_silent(audio);
+
+		if (output_mode != OUTPUT_SDL && !dsp->paced) {
+			if (p.sleep_timer && silence && input_silence_seconds(audio) > p.sleep_timer) {
+				__atomic_store_n(&dsp->naps, dsp->naps + 1, __ATOMIC_RELAXED);
+				nanosleep(&sleep_mode_timer, NULL);
+				continue;
+			}
+		}
+		dsp->prepare_ms += lap_ms(&stage);
+
+		// process: execute FFT and sort frequency bands
+		if (fresh)
+			fft_execute(bands, p.stereo);
+		dsp->fft_ms += lap_ms(&stage);
+		if (p.stereo)
+			number_of_bars /= 2;
+
+		// process: separate frequency bands
+		if (fresh)
+			fft_magnitudes(bands, p.stereo);
+		fft_bar_sums(dsp->bar_table, bands->magnitude, temp_l);
+		if (p.stereo)
+			fft_bar_sums(dsp->bar_table, bands->magnitude + bands->channel_bins, temp_r);
+
+		for (int n = 0; n < number_of_bars; n++) {
+			// multiply with sens, the averaging and eq are in the table
+			temp_l[n] *= p.sens;
+
+			if (temp_l[n] <= p.ignore)
+				temp_l[n] = 0;
+
+			bars_left[n] = temp_l[n];
 
-	int z;
+			if (p.stereo) {
+				temp_r[n] *= p.sens;
 
-	// process [smoothing]: monstercat-style "average"
+				if (temp_r[n] <= p.ignore)
+					temp_r[n] = 0;
 
-	int m_y, de;
-	if (waves > 0) {
-		for (z = 0; z < number_of_bars; z++) { // waves
-			bars[z] = bars[z] / 1.25;
-			// if (bars[z] < 1) bars[z] = 1;
-			for (m_y = z - 1; m_y >= 0; m_y--) {
-				de = z - m_y;
-				bars[m_y] = max(bars[z] - pow(de, 2), bars[m_y]);
+				bars_right[n] = temp_r[n];
 			}
-			for (m_y = z + 1; m_y < number_of_bars; m_y++) {
-				de = m_y - z;
-				bars[m_y] = max(bars[z] - pow(de, 2), bars[m_y]);
+		}
+		if (p.stereo)
+			number_of_bars *= 2;
+		// process [filter]
+
+		if (p.monstercat) {
+			if (p.stereo) {
+				bars_left = monstercat_filter(bars_left, number_of_bars / 2, p.waves, p.monstercat);
+				bars_right =
+					monstercat_filter(bars_right, number_of_bars / 2, p.waves, p.monstercat);
+			} else {
+				bars_left = monstercat_filter(bars_left, number_of_bars, p.waves, p.monstercat);
 			}
 		}
-	} else if (monstercat > 0) {
-		for (z = 0; z < number_of_bars; z++) {
-			// if (bars[z] < 1)bars[z] = 1;
-			for (m_y = z - 1; m_y >= 0; m_y--) {
-				de = z - m_y;
-				bars[m_y] = max(bars[z] / pow(monstercat, de), bars[m_y]);
+		dsp->bars_ms += lap_ms(&stage);
+
+		// process [smoothing]: mirroring, falloff, integral and clamping, each
+		// one pass over all bars
+		bars_gather(&state, bars_left, number_of_bars);
+		if (g > 0)
+			bars_falloff(&state, number_of_bars, g, steps);
+		if (p.integral > 0)
+			bars_integral(&state, number_of_bars, integral_decay, integral_gain, height);
+
+		// zero values causes divided by zero segfault (if not raw)
+		int over = bars_output(&state, number_of_bars, output_mode != OUTPUT_RAW ? 1 : 0, height,
+				bars);
+
+#ifndef NDEBUG
+		for (int n = 0; n < number_of_bars; n++) {
+			if (bars[n] < minvalue) {
+				minvalue = bars[n];
+				debug("min value: %d\n", minvalue); // checking maxvalue 10000
 			}
-			for (m_y = z + 1; m_y < number_of_bars; m_y++) {
-				de = m_y - z;
-				bars[m_y] = max(bars[z] / pow(monstercat, de), bars[m_y]);
+			if (bars[n] > maxvalue) {
+				maxvalue = bars[n];
 			}
 		}
+#endif
+
+		// automatic sense adjustment
+		if (p.autosens && !silence) {
+			if (over) {
+				p.sens = p.sens * pow(0.98, steps);
+				dsp->first = false;
+			} else {
+				p.sens = p.sens * pow(1.001, steps);
+				if (dsp->first)
+					p.sens = p.sens * pow(1.1, steps);
+			}
+		}
+		dsp->smoothing_ms += lap_ms(&stage);
+		dsp->frames++;
+
+#ifndef NDEBUG
+		__atomic_store_n(&dsp->min_value, minvalue, __ATOMIC_RELAXED);
+		__atomic_store_n(&dsp->max_value, maxvalue, __ATOMIC_RELAXED);
+		__atomic_store(&dsp->sens, &p.sens, __ATOMIC_RELAXED);
+#endif
+
+		if (p.draw_and_quit > 0) {
+			total_frames++;
+			if (total_frames >= p.draw_and_quit) {
+				for (int n = 0; n < number_of_bars; n++) {
+					if (output_mode != OUTPUT_RAW && bars[n] == 1) {
+						bars[n] = 0;
+					}
+					dsp->total_bar_height += bars[n];
+				}
+				__atomic_store_n(&dsp->quit, 1, __ATOMIC_RELEASE);
+				break;
+			}
+		}
+
+		// output: hand the frame to the renderer
+		struct bar_frame *frame = mailbox_back(&dsp->mailbox);
+		frame->sequence = ++sequence;
+		frame->number_of_bars = number_of_bars;
+		memcpy(frame->bars, bars, number_of_bars * sizeof(int));
+		clock_gettime(CLOCK_MONOTONIC, &frame->time);
+		uint64_t latency_nsec = __atomic_load_n(&audio->latency_usec, __ATOMIC_RELAXED) * 1000;
+		frame->time.tv_sec -= latency_nsec / 1000000000;
+		frame->time.tv_nsec -= latency_nsec % 1000000000;
+		if (frame->time.tv_nsec < 0) {
+			frame->time.tv_nsec += 1000000000;
+			frame->time.tv_sec--;
+		}
+		mailbox_post(&dsp->mailbox);
+
+		if (dsp->paced)
+			semaphore_post(&dsp->posted);
+		else
+			wait_for_next_frame(&deadline, dsp->frame_nsec);
 	}
 
-	return bars;
+	// main waits for a frame, let it see why there is none
+	if (dsp->paced)
+		semaphore_post(&dsp->posted);
+
+	dsp->bars_left = bars_left;
+	dsp->bars_right = bars_right;
+	return NULL;
 }
 
 // general: entry point
@@ -235,9 +684,11 @@ int main()
 		}
 	} */
 
-	// Initialize display
+	// The display is made once the config says whether it has a window
 	struct Display *display = NULL;
-	display = make_display(800, 800, "TURBAVIS");
+	bool exporting = false;
+
+	bool reloading GCC_UNUSED = false;
 
 	// general: main loop
 	// TODO: split and clean up code
@@ -255,6 +706,32 @@ int main()
 		bool first = true;
 		int inAtty;
 
+		// Initialize display, offscreen when exporting. Both stay as they
+		// are across reloads.
+		if (display == NULL) {
+			exporting = p.export_file[0] != '\0';
+
+			if (exporting) {
+				enum export_format format =
+					strcmp(p.export_format, "rgba") == 0 ? EXPORT_RGBA : EXPORT_Y4M;
+				struct Export *export = open_export(p.export_file, format,
+						p.export_width, p.export_height, p.framerate);
+
+				if (export != NULL) {
+					display = make_headless_display(p.export_width, p.export_height);
+					if (display != NULL)
+						attach_export(display, export);
+				}
+			} else {
+				display = make_display(800, 800, "TURBAVIS");
+			}
+
+			if (display == NULL)
+				exit(EXIT_FAILURE);
+		}
+
+		set_particle_grid(display, p.grid_width, p.grid_height);
+
 		output_mode = p.output;
 
 		if (output_mode != OUTPUT_RAW) {
@@ -297,7 +774,7 @@ int main()
 
 		// input: init
 		int *bars_left, *bars_right;
-		double *temp_l, *temp_r;
+		sample_t *temp_l, *temp_r;
 
 		int bass_cut_off = 150;
 		int treble_cut_off = 2500;
@@ -308,11 +785,13 @@ int main()
 		audio.source = malloc(1 + strlen(p.audio_source));
 		strcpy(audio.source, p.audio_source);
 
+		if (pipe(audio.wakeup_pipe) != 0) {
+			fprintf(stderr, "could not create input wakeup pipe: %s\n", strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+
 		audio.format = -1;
 		audio.rate = 0;
-		audio.FFTbassbufferSize = MAX_BARS * 4;
-		audio.FFTmidbufferSize = MAX_BARS * 2;
-		audio.FFTtreblebufferSize = MAX_BARS;
 		audio.terminate = 0;
 		if (p.stereo)
 			audio.channels = 2;
@@ -330,82 +809,48 @@ int main()
 		audio.bass_index = 0;
 		audio.mid_index = 0;
 		audio.treble_index = 0;
-		audio.bass_multiplier = (double *)malloc(audio.FFTbassbufferSize * sizeof(double));
-		audio.mid_multiplier = (double *)malloc(audio.FFTmidbufferSize * sizeof(double));
-		audio.treble_multiplier = (double *)malloc(audio.FFTtreblebufferSize * sizeof(double));
-
-		temp_l = (double *)malloc((audio.FFTbassbufferSize / 2 + 1) * sizeof(double));
-		temp_r = (double *)malloc((audio.FFTbassbufferSize / 2 + 1) * sizeof(double));
-
-		bars_left = (int *)malloc(MAX_BARS * sizeof(int));
-		bars_right = (int *)malloc(MAX_BARS * sizeof(int));
 
-		for (int i = 0; i < audio.FFTbassbufferSize; i++) {
-			audio.bass_multiplier[i] =
-				0.5 * (1 - cos(2 * M_PI * i / (audio.FFTbassbufferSize - 1)));
+		// exporting takes in the input one frame at a time
+		audio.paced = exporting;
+		if (audio.paced) {
+			pthread_mutex_init(&audio.pace_lock, NULL);
+			pthread_cond_init(&audio.pace_cond, NULL);
 		}
-		for (int i = 0; i < audio.FFTmidbufferSize; i++) {
-			audio.mid_multiplier[i] = 0.5 * (1 - cos(2 * M_PI * i / (audio.FFTmidbufferSize - 1)));
-		}
-		for (int i = 0; i < audio.FFTtreblebufferSize; i++) {
-			audio.treble_multiplier[i] =
-				0.5 * (1 - cos(2 * M_PI * i / (audio.FFTtreblebufferSize - 1)));
-		}
-		// BASS
-		// audio.FFTbassbufferSize =  audio.rate / 20; // audio.FFTbassbufferSize;
-
-		audio.in_bass_r = fftw_alloc_real(audio.FFTbassbufferSize);
-		audio.in_bass_l = fftw_alloc_real(audio.FFTbassbufferSize);
-		audio.in_bass_r_raw = fftw_alloc_real(audio.FFTbassbufferSize);
-		audio.in_bass_l_raw = fftw_alloc_real(audio.FFTbassbufferSize);
-
-		out_bass_l = fftw_alloc_complex(audio.FFTbassbufferSize / 2 + 1);
-		out_bass_r = fftw_alloc_complex(audio.FFTbassbufferSize / 2 + 1);
-		memset(out_bass_l, 0, (audio.FFTbassbufferSize / 2 + 1) * sizeof(fftw_complex));
-		memset(out_bass_r, 0, (audio.FFTbassbufferSize / 2 + 1) * sizeof(fftw_complex));
-
-		p_bass_l = fftw_plan_dft_r2c_1d(audio.FFTbassbufferSize, audio.in_bass_l, out_bass_l,
-				FFTW_MEASURE);
-		p_bass_r = fftw_plan_dft_r2c_1d(audio.FFTbassbufferSize, audio.in_bass_r, out_bass_r,
-				FFTW_MEASURE);
-
-		// MID
-		// audio.FFTmidbufferSize =  audio.rate / bass_cut_off; // audio.FFTbassbufferSize;
-		audio.in_mid_r = fftw_alloc_real(audio.FFTmidbufferSize);
-		audio.in_mid_l = fftw_alloc_real(audio.FFTmidbufferSize);
-		audio.in_mid_r_raw = fftw_alloc_real(audio.FFTmidbufferSize);
-		audio.in_mid_l_raw = fftw_alloc_real(audio.FFTmidbufferSize);
-
-		out_mid_l = fftw_alloc_complex(audio.FFTmidbufferSize / 2 + 1);
-		out_mid_r = fftw_alloc_complex(audio.FFTmidbufferSize / 2 + 1);
-		memset(out_mid_l, 0, (audio.FFTmidbufferSize / 2 + 1) * sizeof(fftw_complex));
-		memset(out_mid_r, 0, (audio.FFTmidbufferSize / 2 + 1) * sizeof(fftw_complex));
-
-		p_mid_l =
-			fftw_plan_dft_r2c_1d(audio.FFTmidbufferSize, audio.in_mid_l, out_mid_l, FFTW_MEASURE);
-		p_mid_r =
-			fftw_plan_dft_r2c_1d(audio.FFTmidbufferSize, audio.in_mid_r, out_mid_r, FFTW_MEASURE);
-
-		// TRIEBLE
-		// audio.FFTtreblebufferSize =  audio.rate / treble_cut_off; // audio.FFTbassbufferSize;
-		audio.in_treble_r = fftw_alloc_real(audio.FFTtreblebufferSize);
-		audio.in_treble_l = fftw_alloc_real(audio.FFTtreblebufferSize);
-		audio.in_treble_r_raw = fftw_alloc_real(audio.FFTtreblebufferSize);
-		audio.in_treble_l_raw = fftw_alloc_real(audio.FFTtreblebufferSize);
-
-		out_treble_l = fftw_alloc_complex(audio.FFTtreblebufferSize / 2 + 1);
-		out_treble_r = fftw_alloc_complex(audio.FFTtreblebufferSize / 2 + 1);
-		memset(out_treble_l, 0, (audio.FFTtreblebufferSize / 2 + 1) * sizeof(fftw_complex));
-		memset(out_treble_r, 0, (audio.FFTtreblebufferSize / 2 + 1) * sizeof(fftw_complex));
-
-		p_treble_l = fftw_plan_dft_r2c_1d(audio.FFTtreblebufferSize, audio.in_treble_l,
-				out_treble_l, FFTW_MEASURE);
-		p_treble_r = fftw_plan_dft_r2c_1d(audio.FFTtreblebufferSize, audio.in_treble_r,
-				out_treble_r, FFTW_MEASURE);
-
-		debug("got buffer size: %d, %d, %d", audio.FFTbassbufferSize, audio.FFTmidbufferSize,
-				audio.FFTtreblebufferSize);
 
+		temp_l = (sample_t *)malloc(MAX_BARS * sizeof(sample_t));
+		temp_r = (sample_t *)malloc(MAX_BARS * sizeof(sample_t));
+
+		// both channels in one block, the smoothing gathers the bars from either
+		bars_left = (int *)malloc(2 * MAX_BARS * sizeof(int));
+		bars_right = bars_left + MAX_BARS;
+
+		// fftw has to set up its threads before anything else of it is used,
+		// allocations included
+		fft_init(p.fft_patient, p.packed_stereo, p.fft_threads, p.bass_resolution);
+
+		// input history, twice the largest FFT of any rate so the writer stays
+		// well ahead of the reader
+		audio.ring_size = 2 * FFT_MAX_SIZE;
+		audio.ring_l = FFTW(alloc_real)(audio.ring_size);
+		audio.ring_r = FFTW(alloc_real)(audio.ring_size);
+		audio.write_index = 0;
+		audio.read_index = 0;
+
+		// FFT sizes follow the sample rate, which most inputs only know once
+		// they are running. start out with the common rate. the input threads
+		// size their reads by its treble band, once and for all, since the
+		// bands change under them when the real rate turns up. the other common
+		// rates are planned right away, switching to one of them is then only a
+		// lookup and fits in a frame.
+		struct fft_bands bands;
+		double planning_ms = fft_plan_common_rates();
+		planning_ms +=
+			fft_select_bands(&bands, &audio, p.input == INPUT_FIFO ? p.fifoSample : 44100);
+		audio.block_frames = audio.FFTtreblebufferSize;
+
+		// start out silent, but with the sleep timer only counting from now
+		audio.noise_floor = p.noise_floor;
+		audio.last_sound_nsec = input_clock_nsec();
 		reset_output_buffers(&audio);
 
 		debug("starting audio thread\n");
@@ -433,6 +878,8 @@ int main()
 					}
 				}
 
+				audio.period_size = p.period_size;
+				audio.buffer_size = p.buffer_size;
 				thr_id = pthread_create(&p_thread, NULL, input_alsa,
 						(void *)&audio); // starting alsamusic listener
 
@@ -453,9 +900,9 @@ int main()
 #endif
 			case INPUT_FIFO:
 				// starting fifomusic listener
-				thr_id = pthread_create(&p_thread, NULL, input_fifo, (void *)&audio);
 				audio.rate = p.fifoSample;
 				audio.format = p.fifoSampleBits;
+				thr_id = pthread_create(&p_thread, NULL, input_fifo, (void *)&audio);
 				break;
 #ifdef PULSE
 			case INPUT_PULSE:
@@ -463,6 +910,7 @@ int main()
 					getPulseDefaultSink((void *)&audio);
 				}
 				// starting pulsemusic listener
+				audio.target_latency_usec = p.input_latency * 1000;
 				thr_id = pthread_create(&p_thread, NULL, input_pulse, (void *)&audio);
 				audio.rate = 44100;
 				break;
@@ -500,32 +948,19 @@ int main()
 				exit(EXIT_FAILURE); // Can't happen.
 		}
 
+		planning_ms += fft_select_bands(&bands, &audio, audio.rate);
+		debug("FFT setup on %s took %.1f ms\n", reloading ? "reload" : "cold start", planning_ms);
+
 		if (p.upper_cut_off > audio.rate / 2) {
 			cleanup();
 			fprintf(stderr, "higher cuttoff frequency can't be higher than sample rate / 2");
 			exit(EXIT_FAILURE);
 		}
 
-		int bars[MAX_BARS];
-		int bars_mem[MAX_BARS];
-		int bars_last[MAX_BARS];
-		int previous_frame[MAX_BARS];
-		int fall[MAX_BARS];
-		float bars_peak[MAX_BARS];
-
 		int height, lines, width, remainder, fp;
 
 		bool reloadConf = false;
 		while (!reloadConf) { // jumping back to this loop means that you resized the screen
-			for (int n = 0; n < MAX_BARS; n++) {
-				bars_last[n] = 0;
-				previous_frame[n] = 0;
-				fall[n] = 0;
-				bars_peak[n] = 0;
-				bars_mem[n] = 0;
-				bars[n] = 0;
-			}
-
 			// frequencies on x axis require a bar width of four or more
 			if (p.xaxis == FREQUENCY && p.bar_width < 4)
 				p.bar_width = 4;
@@ -541,6 +976,10 @@ int main()
 			// init_terminal_noncurses(inAtty, p.col, p.bgcol, width, lines, p.bar_width);
 			height = lines * 8;
 
+			// An export needs no terminal, scale its bars to the frame instead
+			if (exporting)
+				height = p.export_height;
+
 			// handle for user setting too many bars
 			if (p.fixedbars) {
 				p.autobars = 0;
@@ -573,8 +1012,9 @@ int main()
 			if (remainder < 0)
 				remainder = 0;
 
-			// process [smoothing]: calculate gravity
-			float g = p.gravity * log10((float)height) * 0.05 * pow((60 / (float)p.framerate), 2.5);
+			// process [smoothing]: calculate gravity, per SMOOTHING_HZ frame squared since
+			// the falloff runs on measured time whatever the frame rate
+			float g = p.gravity * log10((float)height) * 0.05;
 
 			if (output_mode == OUTPUT_SDL) {
 				g *= 1.5; // we can assume sdl to have higher resolution so a bit more g is
@@ -584,6 +1024,11 @@ int main()
 			// calculate integral value, must be reduced with height
 			double integral = p.integral;
 
+			// the rate can drop below twice the configured cutoff when it changes mid-stream
+			int upper_cut_off = p.upper_cut_off;
+			if (upper_cut_off > (int)bands.rate / 2)
+				upper_cut_off = bands.rate / 2;
+
 			// process: calculate cutoff frequencies and eq
 			if (p.stereo)
 				number_of_bars =
@@ -598,7 +1043,7 @@ int main()
 			}
 
 			// calculate frequency constant (used to distribute bars across the frequency band)
-			double frequency_constant = log10((float)p.lower_cut_off / (float)p.upper_cut_off) /
+			double frequency_constant = log10((float)p.lower_cut_off / (float)upper_cut_off) /
 				(1 / ((float)number_of_bars + 1) - 1);
 
 			float cut_off_frequency[MAX_BARS];
@@ -619,7 +1064,7 @@ int main()
 				double bar_distribution_coefficient = frequency_constant * (-1);
 				bar_distribution_coefficient +=
 					((float)n + 1) / ((float)number_of_bars + 1) * frequency_constant;
-				cut_off_frequency[n] = p.upper_cut_off * pow(10, bar_distribution_coefficient);
+				cut_off_frequency[n] = upper_cut_off * pow(10, bar_distribution_coefficient);
 
 				if (n > 0) {
 					if (cut_off_frequency[n - 1] >= cut_off_frequency[n] &&
@@ -629,7 +1074,7 @@ int main()
 							(cut_off_frequency[n - 1] - cut_off_frequency[n - 2]);
 				}
 
-				relative_cut_off[n] = cut_off_frequency[n] / (audio.rate / 2);
+				relative_cut_off[n] = cut_off_frequency[n] / (bands.rate / 2);
 				// remember nyquist!, per my calculations this should be rate/2
 				// and nyquist freq in M/2 but testing shows it is not...
 				// or maybe the nq freq is in M/4
@@ -709,7 +1154,7 @@ int main()
 								relative_cut_off[n] = (float)(FFTbuffer_lower_cut_off[n]) /
 									((float)audio.FFTtreblebufferSize / 2);
 
-							cut_off_frequency[n] = relative_cut_off[n] * ((float)audio.rate / 2);
+							cut_off_frequency[n] = relative_cut_off[n] * ((float)bands.rate / 2);
 						}
 					} else {
 						if (FFTbuffer_upper_cut_off[n - 1] <= FFTbuffer_lower_cut_off[n - 1])
@@ -722,6 +1167,26 @@ int main()
 				}
 			}
 
+			// the bins of each bar as indices into the spectrum arena, where all bands
+			// of a channel lie back to back, averaged and equalized by one weight
+			int bin_lower[MAX_BARS], bin_upper[MAX_BARS];
+			sample_t bar_weight[MAX_BARS];
+			for (int n = 0; n < number_of_bars; n++) {
+				int offset = bands.treble->bin_offset;
+				if (n <= bass_cut_off_bar)
+					offset = bands.bass->bin_offset;
+				else if (n <= treble_cut_off_bar)
+					offset = bands.mid->bin_offset;
+				bin_lower[n] = offset + FFTbuffer_lower_cut_off[n];
+				bin_upper[n] = offset + FFTbuffer_upper_cut_off[n];
+				bar_weight[n] =
+					eq[n] / (FFTbuffer_upper_cut_off[n] - FFTbuffer_lower_cut_off[n] + 1);
+			}
+			struct bar_table bar_table = {.bars = number_of_bars,
+				.first = bin_lower,
+				.last = bin_upper,
+				.weight = bar_weight};
+
 			if (p.stereo)
 				number_of_bars = number_of_bars * 2;
 
@@ -749,27 +1214,48 @@ int main()
 
 			bool resizeTerminal = false;
 
-			int frame_time_msec = (1 / (float)p.framerate) * 1000;
-			struct timespec framerate_timer = {.tv_sec = 0, .tv_nsec = 0};
-			if (p.framerate <= 1) {
-				framerate_timer.tv_sec = frame_time_msec * 1000;
-			} else {
-				framerate_timer.tv_sec = 0;
-				framerate_timer.tv_nsec = frame_time_msec * 1e6;
-			}
+			long frame_nsec = p.framerate > 0 ? 1000000000L / p.framerate : 1000000000L;
 
-			int sleep_counter = 0;
-			bool silence = false;
 			char ch = '\0';
 
+			// process: the analysis runs on its own thread from here on and posts a
+			// frame of bars at the configured rate. this loop draws the newest one
+			// on its own clock and keeps everything that has to stay on the main
+			// thread, the GL context, events and reloads.
+			struct dsp dsp = {.audio = &audio,
+				.bands = &bands,
+				.bar_table = &bar_table,
+				.temp_l = temp_l,
+				.temp_r = temp_r,
+				.bars_left = bars_left,
+				.bars_right = bars_right,
+				.number_of_bars = number_of_bars,
+				.height = height,
+				.g = g,
+				.integral = integral,
+				.frame_nsec = frame_nsec,
+				.first = first,
+				.sens = p.sens,
+				.paced = exporting};
+			mailbox_init(&dsp.mailbox);
+			semaphore_init(&dsp.posted, 0);
+			semaphore_init(&dsp.drawn, 1);
+
+			pthread_t dsp_thread_id;
+			if (pthread_create(&dsp_thread_id, NULL, dsp_thread, &dsp) != 0) {
+				cleanup();
+				fprintf(stderr, "could not start the DSP thread\n");
+				exit(EXIT_FAILURE);
+			}
+
+			unsigned long frames_drawn = 0, frames_taken = 0, frames_dropped = 0;
+			unsigned long last_sequence = 0;
 #ifndef NDEBUG
-			int maxvalue = 0;
-			int minvalue = 0;
+			unsigned long last_naps = 0;
 #endif
-
-			struct timespec sleep_mode_timer = {.tv_sec = 1, .tv_nsec = 0};
-
-			int total_frames = 0;
+			double render_ms = 0, frame_age_ms = 0;
+			struct timespec render_deadline, render_start;
+			clock_gettime(CLOCK_MONOTONIC, &render_deadline);
 
 			while (!resizeTerminal) {
 				if (should_reload) {
@@ -793,222 +1279,36 @@ int main()
 
 #ifndef NDEBUG
 				// clear();
+				unsigned long naps = __atomic_load_n(&dsp.naps, __ATOMIC_RELAXED);
+				if (naps != last_naps)
+					printw("no sound detected for %d sec, going to sleep mode\n", p.sleep_timer);
+				last_naps = naps;
+
+				double sens;
+				__atomic_load(&dsp.sens, &sens, __ATOMIC_RELAXED);
+				mvprintw(number_of_bars + 1, 0, "sensitivity %.10e", sens);
+				mvprintw(number_of_bars + 2, 0, "min value: %d\n",
+						__atomic_load_n(&dsp.min_value, __ATOMIC_RELAXED));
+				mvprintw(number_of_bars + 3, 0, "max value: %d\n",
+						__atomic_load_n(&dsp.max_value, __ATOMIC_RELAXED));
 				refresh();
+				(void)x_axis_info;
 #endif
 
-				// process: check if input is present
-				silence = true;
-
-				for (int n = 0; n < audio.FFTbassbufferSize; n++) {
-					if (audio.in_bass_l[n] || audio.in_bass_r[n]) {
-						silence = false;
-						break;
-					}
-				}
-
-				if (output_mode != OUTPUT_SDL) {
-					if (p.sleep_timer) {
-						if (silence && sleep_counter <= p.framerate * p.sleep_timer)
-							sleep_counter++;
-						else if (!silence)
-							sleep_counter = 0;
-
-						if (sleep_counter > p.framerate * p.sleep_timer) {
-#ifndef NDEBUG
-							printw("no sound detected for 30 sec, going to sleep mode\n");
-#endif
-							nanosleep(&sleep_mode_timer, NULL);
-							continue;
-						}
-					}
-				}
-
-				// process: execute FFT and sort frequency bands
-				pthread_mutex_lock(&lock);
-				fftw_execute(p_bass_l);
-				fftw_execute(p_mid_l);
-				fftw_execute(p_treble_l);
-				if (p.stereo) {
-					fftw_execute(p_bass_r);
-					fftw_execute(p_mid_r);
-					fftw_execute(p_treble_r);
-					number_of_bars /= 2;
-				}
-				pthread_mutex_unlock(&lock);
-
-				// process: separate frequency bands
-				for (int n = 0; n < number_of_bars; n++) {
-
-					temp_l[n] = 0;
-					if (p.stereo)
-						temp_r[n] = 0;
-
-					// process: add upp FFT values within bands
-					for (int i = FFTbuffer_lower_cut_off[n]; i <= FFTbuffer_upper_cut_off[n]; i++) {
-						if (n <= bass_cut_off_bar) {
-
-							temp_l[n] += hypot(out_bass_l[i][0], out_bass_l[i][1]);
-
-							if (p.stereo)
-								temp_r[n] += hypot(out_bass_r[i][0], out_bass_r[i][1]);
-
-						} else if (n > bass_cut_off_bar && n <= treble_cut_off_bar) {
-
-							temp_l[n] += hypot(out_mid_l[i][0], out_mid_l[i][1]);
-
-							if (p.stereo)
-								temp_r[n] += hypot(out_mid_r[i][0], out_mid_r[i][1]);
-
-						} else if (n > treble_cut_off_bar) {
-
-							temp_l[n] += hypot(out_treble_l[i][0], out_treble_l[i][1]);
-
-							if (p.stereo)
-								temp_r[n] += hypot(out_treble_r[i][0], out_treble_r[i][1]);
-						}
-					}
-
-					// getting average multiply with sens and eq
-					temp_l[n] /= FFTbuffer_upper_cut_off[n] - FFTbuffer_lower_cut_off[n] + 1;
-					temp_l[n] *= p.sens * eq[n];
-
-					if (temp_l[n] <= p.ignore)
-						temp_l[n] = 0;
-
-					bars_left[n] = temp_l[n];
-
-					if (p.stereo) {
-						temp_r[n] /= FFTbuffer_upper_cut_off[n] - FFTbuffer_lower_cut_off[n] + 1;
-						temp_r[n] *= p.sens * eq[n];
-
-						if (temp_r[n] <= p.ignore)
-							temp_r[n] = 0;
-
-						bars_right[n] = temp_r[n];
-					}
-				}
-				if (p.stereo)
-					number_of_bars *= 2;
-				// process [filter]
-
-				if (p.monstercat) {
-					if (p.stereo) {
-						bars_left =
-							monstercat_filter(bars_left, number_of_bars / 2, p.waves, p.monstercat);
-						bars_right = monstercat_filter(bars_right, number_of_bars / 2, p.waves,
-								p.monstercat);
-					} else {
-						bars_left =
-							monstercat_filter(bars_left, number_of_bars, p.waves, p.monstercat);
-					}
-				}
-
-				// processing signal
-
-				bool senselow = true;
-
-				for (int n = 0; n < number_of_bars; n++) {
-					// mirroring stereo channels
-					if (p.stereo) {
-						if (n < number_of_bars / 2) {
-							if (p.reverse) {
-								bars[n] = bars_left[n];
-							} else {
-								bars[n] = bars_left[number_of_bars / 2 - n - 1];
-							}
-						} else {
-							if (p.reverse) {
-								bars[n] = bars_right[number_of_bars - n - 1];
-							} else {
-								bars[n] = bars_right[n - number_of_bars / 2];
-							}
-						}
-
-					} else {
-						if (p.reverse) {
-							bars[n] = bars_left[number_of_bars - 1 - n];
-						} else {
-							bars[n] = bars_left[n];
-						}
-					}
-
-					// process [smoothing]: falloff
-					if (g > 0) {
-						if (bars[n] < bars_last[n]) {
-							bars[n] = bars_peak[n] - (g * fall[n] * fall[n]);
-							if (bars[n] < 0)
-								bars[n] = 0;
-							fall[n]++;
-						} else {
-							bars_peak[n] = bars[n];
-							fall[n] = 0;
-						}
-
-						bars_last[n] = bars[n];
-					}
-
-					// process [smoothing]: integral
-					if (p.integral > 0) {
-						bars[n] = bars_mem[n] * integral + bars[n];
-						bars_mem[n] = bars[n];
-
-						int diff = height - bars[n];
-						if (diff < 0)
-							diff = 0;
-						double div = 1 / (diff + 1);
-						// bars[n] = bars[n] - pow(div, 10) * (height + 1);
-						bars_mem[n] = bars_mem[n] * (1 - div / 20);
-					}
-#ifndef NDEBUG
-					mvprintw(n, 0, "%d: f:%f->%f (%d->%d), eq:\
-							%15e, peak:%d \n",
-							n, cut_off_frequency[n], cut_off_frequency[n + 1],
-							FFTbuffer_lower_cut_off[n], FFTbuffer_upper_cut_off[n], eq[n],
-							bars[n]);
-
-					if (bars[n] < minvalue) {
-						minvalue = bars[n];
-						debug("min value: %d\n", minvalue); // checking maxvalue 10000
-					}
-					if (bars[n] > maxvalue) {
-						maxvalue = bars[n];
-					}
-					if (bars[n] < 0) {
-						debug("negative bar value!! %d\n", bars[n]);
-						//    exit(EXIT_FAILURE); // Can't happen.
-					}
-
-#endif
-
-					// zero values causes divided by zero segfault (if not raw)
-					if (output_mode != OUTPUT_RAW && bars[n] < 1)
-						bars[n] = 1;
-
-					// automatic sense adjustment
-					if (p.autosens && !silence) {
-						if (bars[n] > height && senselow) {
-							p.sens = p.sens * 0.98;
-							senselow = false;
-							first = false;
-						}
-					}
+				// the DSP thread stopped for a new rate, the tables are rebuilt
+				// right away by going through the resize path
+				if (__atomic_load_n(&dsp.relayout, __ATOMIC_ACQUIRE)) {
+					resizeTerminal = true;
+					continue;
 				}
 
-				if (p.autosens && !silence && senselow) {
-					p.sens = p.sens * 1.001;
-					if (first)
-						p.sens = p.sens * 1.1;
+				if (__atomic_load_n(&dsp.quit, __ATOMIC_ACQUIRE)) {
+					resizeTerminal = true;
+					reloadConf = true;
+					should_quit = true;
+					break;
 				}
 
-#ifndef NDEBUG
-				mvprintw(number_of_bars + 1, 0, "sensitivity %.10e", p.sens);
-				mvprintw(number_of_bars + 2, 0, "min value: %d\n",
-						minvalue); // checking maxvalue 10000
-				mvprintw(number_of_bars + 3, 0, "max value: %d\n",
-						maxvalue); // checking maxvalue 10000
-				(void)x_axis_info;
-#endif
-
 				// output: draw processed input
 				int rc;
 
@@ -1022,8 +1322,6 @@ int main()
 					should_quit = true;
 				}
 
-				memcpy(previous_frame, bars, MAX_BARS * sizeof(int));
-
 				// checking if audio thread has exited unexpectedly
 				if (audio.terminate == 1) {
 					cleanup();
@@ -1031,69 +1329,97 @@ int main()
 					exit(EXIT_FAILURE);
 				}
 
-				if (output_mode != OUTPUT_SDL)
-					nanosleep(&framerate_timer, NULL);
-
-				if (p.draw_and_quit > 0) {
-					total_frames++;
-					if (total_frames >= p.draw_and_quit) {
-						for (int n = 0; n < number_of_bars; n++) {
-							if (output_mode != OUTPUT_RAW && bars[n] == 1) {
-								bars[n] = 0;
-							}
-							total_bar_height += bars[n];
-						}
-						resizeTerminal = true;
-						reloadConf = true;
-						should_quit = true;
-						break;
-					}
+				// Copy the newest bars to the display, if there are any, straight
+				// into the GPU visible slot of the next frame. when exporting every
+				// frame is drawn, as soon as it is there. none means the DSP thread
+				// stopped, the checks above say why.
+				if (exporting)
+					semaphore_wait(&dsp.posted);
+				clock_gettime(CLOCK_MONOTONIC, &render_start);
+				const struct bar_frame *frame = mailbox_take(&dsp.mailbox);
+				if (exporting && !frame)
+					continue;
+				if (frame) {
+					float *values = map_bars(display);
+					for (int n = 0; n < frame->number_of_bars; n++)
+						values[n] = ((float) frame->bars[n])/height;
+					commit_bars(display, frame->number_of_bars);
+
+					frame_age_ms += elapsed_ms(&frame->time, &render_start);
+					frames_dropped += frame->sequence - last_sequence - 1;
+					last_sequence = frame->sequence;
+					frames_taken++;
 				}
 
-				// Copy to display bars
-				display->num_bars = number_of_bars;
-				for (int n = 0; n < number_of_bars; n++)
-					display->bars[n + 1].value = ((float) bars[n])/height;
-
 				// Render to the display
 				render(display);
+				render_ms += lap_ms(&render_start);
+				frames_drawn++;
+
+				if (exporting)
+					semaphore_post(&dsp.drawn);
+				else
+					wait_for_next_frame(&render_deadline, frame_nsec);
 			} // resize terminal
 
+			__atomic_store_n(&dsp.stop, 1, __ATOMIC_RELEASE);
+			semaphore_post(&dsp.drawn);
+			pthread_join(dsp_thread_id, NULL);
+			semaphore_destroy(&dsp.posted);
+			semaphore_destroy(&dsp.drawn);
+			first = dsp.first;
+			bars_left = dsp.bars_left;
+			bars_right = dsp.bars_right;
+			total_bar_height += dsp.total_bar_height;
+
+			if (dsp.frames)
+				debug("dsp thread: %lu frames, %.3f ms prepare, %.3f ms FFT, %.3f ms bars, "
+						"%.3f ms smoothing per frame\n",
+						dsp.frames, dsp.prepare_ms / dsp.frames, dsp.fft_ms / dsp.frames,
+						dsp.bars_ms / dsp.frames, dsp.smoothing_ms / dsp.frames);
+			if (frames_taken)
+				debug("render thread: %lu frames, %.3f ms per frame, audio %.1f ms old when "
+						"its bars were drawn, %lu never drawn\n",
+						frames_drawn, render_ms / frames_drawn, frame_age_ms / frames_taken,
+						frames_dropped);
+
+			if (dsp.relayout) {
+				planning_ms =
+					fft_select_bands(&bands, &audio, __atomic_load_n(&audio.rate, __ATOMIC_RELAXED));
+				debug("FFT setup on rate change took %.1f ms\n", planning_ms);
+			}
+
 		} // reloading config
 
 		//**telling audio thread to terminate**//
 		audio.terminate = 1;
+		wake_input_thread(&audio);
 		pthread_join(p_thread, NULL);
+		close(audio.wakeup_pipe[0]);
+		close(audio.wakeup_pipe[1]);
+		if (audio.paced) {
+			pthread_mutex_destroy(&audio.pace_lock);
+			pthread_cond_destroy(&audio.pace_cond);
+		}
+
+		debug("input snapshots: %lu reused, %lu skipped, capture latency %lu us, %lu xruns\n",
+				audio.snapshots_reused, audio.snapshots_skipped,
+				(unsigned long)audio.latency_usec, audio.xruns);
 
 		if (p.userEQ_enabled)
 			free(p.userEQ);
 
 		free(audio.source);
 
-		fftw_free(audio.in_bass_r);
-		fftw_free(audio.in_bass_l);
-		fftw_free(out_bass_r);
-		fftw_free(out_bass_l);
-		fftw_destroy_plan(p_bass_l);
-		fftw_destroy_plan(p_bass_r);
-
-		fftw_free(audio.in_mid_r);
-		fftw_free(audio.in_mid_l);
-		fftw_free(out_mid_r);
-		fftw_free(out_mid_l);
-		fftw_destroy_plan(p_mid_l);
-		fftw_destroy_plan(p_mid_r);
-
-		fftw_free(audio.in_treble_r);
-		fftw_free(audio.in_treble_l);
-		fftw_free(out_treble_r);
-		fftw_free(out_treble_l);
-		fftw_destroy_plan(p_treble_l);
-		fftw_destroy_plan(p_treble_r);
+		FFTW(free)(audio.ring_l);
+		FFTW(free)(audio.ring_r);
 
 		cleanup();
 
 		if (should_quit) {
+			fft_free_bands();
+			if (exporting)
+				finish_export(display);
 			if (p.zero_test && total_bar_height > 0) {
 				fprintf(stderr, "Test mode: expected total bar height to be zero, but was: %d\n",
 						total_bar_height);
@@ -1107,5 +1433,6 @@ int main()
 			}
 		}
 		// fclose(fp);
+		reloading = true;
 	}
 }
@@ -294,6 +294,71 @@ bool validate_config(struct config_params *p, struct error_s *error) {
         return false;
     }
 
+    // validate: noise floor
+    if (p->noise_floor < 0) {
+        write_errorf(error, "noise_floor can't be negative!\n");
+        return false;
+    }
+
+    // validate: particle grid
+    if (p->grid_width < 0 || p->grid_height < 0) {
+        write_errorf(error, "particle grid size can't be negative!\n");
+        return false;
+    }
+
+    // validate: export
+    if (p->export_file[0] != '\0') {
+        if (strcmp(p->export_format, "rgba") != 0 && strcmp(p->export_format, "y4m") != 0) {
+            write_errorf(error,
+                         "export format %s is not supported, supported formats are: 'rgba' "
+                         "and 'y4m'\n",
+                         p->export_format);
+            return false;
+        }
+        if (p->export_width < 1 || p->export_height < 1) {
+            write_errorf(error, "export size must be positive!\n");
+            return false;
+        }
+        // 4:2:0 chroma covers two by two pixels
+        if (strcmp(p->export_format, "y4m") == 0 &&
+            (p->export_width % 2 != 0 || p->export_height % 2 != 0)) {
+            write_errorf(error, "y4m export size must be even!\n");
+            return false;
+        }
+        if (p->input != INPUT_FIFO) {
+            write_errorf(error, "export reads its audio with the 'fifo' input method\n");
+            return false;
+        }
+        if (p->framerate < 1) {
+            write_errorf(error, "export needs a framerate!\n");
+            return false;
+        }
+    }
+
+    // validate: fft threads
+    if (p->fft_threads < 0) {
+        write_errorf(error, "fft_threads can't be negative!\n");
+        return false;
+    }
+
+    // validate: bass resolution, no coarser than the mid band
+    if (p->bass_resolution < 1 || p->bass_resolution > 24) {
+        write_errorf(error, "bass_resolution must be between 1 and 24 Hz!\n");
+        return false;
+    }
+
+    // validate: device buffering
+    if (p->period_size < 0 || p->buffer_size < 0) {
+        write_errorf(error, "period and buffer size can't be negative!\n");
+        return false;
+    }
+
+    // validate: input latency
+    if (p->input_latency < 1) {
+        write_errorf(error, "input latency must be at least 1 ms\n");
+        return false;
+    }
+
     // validate: colors
     if (!validate_colors(p, error)) {
         return false;
@@ -465,6 +530,11 @@ bool load_config(char configPath[PATH_MAX], struct config_params *p, bool colors
     p->lower_cut_off = iniparser_getint(ini, "general:lower_cutoff_freq", 50);
     p->upper_cut_off = iniparser_getint(ini, "general:higher_cutoff_freq", 10000);
     p->sleep_timer = iniparser_getint(ini, "general:sleep_timer", 0);
+    p->noise_floor = iniparser_getdouble(ini, "general:noise_floor", 0);
+    p->fft_patient = iniparser_getint(ini, "general:fft_patient", 0);
+    p->packed_stereo = iniparser_getint(ini, "general:packed_stereo", 0);
+    p->fft_threads = iniparser_getint(ini, "general:fft_threads", 1);
+    p->bass_resolution = iniparser_getint(ini, "general:bass_resolution", 12);
 
     // hidden test features
 
@@ -480,6 +550,8 @@ bool load_config(char configPath[PATH_MAX], struct config_params *p, bool colors
     free(p->mono_option);
     free(p->raw_target);
     free(p->data_format);
+    free(p->export_file);
+    free(p->export_format);
 
     channels = strdup(iniparser_getstring(ini, "output:channels", "stereo"));
     p->mono_option = strdup(iniparser_getstring(ini, "output:mono_option", "average"));
@@ -496,6 +568,14 @@ bool load_config(char configPath[PATH_MAX], struct config_params *p, bool colors
     p->sdl_x = iniparser_getint(ini, "output:sdl_x", -1);
     p->sdl_y = iniparser_getint(ini, "output:sdl_y", -1);
 
+    p->grid_width = iniparser_getint(ini, "output:particle_grid_width", 0);
+    p->grid_height = iniparser_getint(ini, "output:particle_grid_height", 0);
+
+    p->export_file = strdup(iniparser_getstring(ini, "output:export_file", ""));
+    p->export_format = strdup(iniparser_getstring(ini, "output:export_format", "y4m"));
+    p->export_width = iniparser_getint(ini, "output:export_width", 800);
+    p->export_height = iniparser_getint(ini, "output:export_height", 800);
+
     if (strcmp(outputMethod, "sdl") == 0) {
         p->color = strdup(iniparser_getstring(ini, "color:foreground", "#33cccc"));
         p->bcolor = strdup(iniparser_getstring(ini, "color:background", "#111111"));
@@ -534,10 +614,13 @@ bool load_config(char configPath[PATH_MAX], struct config_params *p, bool colors
     }
 
     p->input = input_method_by_name(input_method_name);
+    p->input_latency = iniparser_getint(ini, "input:latency", 10);
     switch (p->input) {
 #ifdef ALSA
     case INPUT_ALSA:
         p->audio_source = strdup(iniparser_getstring(ini, "input:source", "hw:Loopback,1"));
+        p->period_size = iniparser_getint(ini, "input:period_size", 0);
+        p->buffer_size = iniparser_getint(ini, "input:buffer_size", 0);
         break;
 #endif
     case INPUT_FIFO:
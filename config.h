@@ -55,9 +55,10 @@ enum xaxis_scale { NONE, FREQUENCY, NOTE };
 
 struct config_params {
     char *color, *bcolor, *raw_target, *audio_source,
-        /**gradient_color_1, *gradient_color_2,*/ **gradient_colors, *data_format, *mono_option;
+        /**gradient_color_1, *gradient_color_2,*/ **gradient_colors, *data_format, *mono_option,
+        *export_file, *export_format;
     char bar_delim, frame_delim;
-    double monstercat, integral, gravity, ignore, sens;
+    double monstercat, integral, gravity, ignore, sens, noise_floor;
     unsigned int lower_cut_off, upper_cut_off;
     double *userEQ;
     enum input_method input;
@@ -66,7 +67,8 @@ struct config_params {
     int userEQ_keys, userEQ_enabled, col, bgcol, autobars, stereo, is_bin, ascii_range, bit_format,
         gradient, gradient_count, fixedbars, framerate, bar_width, bar_spacing, autosens, overshoot,
         waves, fifoSample, fifoSampleBits, sleep_timer, sdl_width, sdl_height, sdl_x, sdl_y,
-        draw_and_quit, zero_test, non_zero_test, reverse;
+        draw_and_quit, zero_test, non_zero_test, reverse, input_latency, period_size, buffer_size,
+        fft_patient, packed_stereo, fft_threads, bass_resolution, grid_width, grid_height, export_width, export_height;
 };
 
 struct error_s {
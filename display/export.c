@@ -0,0 +1,193 @@
+#include "init.h"
+
+// Write out a frame in RGBA, rows come back from OpenGL bottom first
+void write_rgba(struct Export *export, const unsigned char *pixels)
+{
+	size_t row = (size_t) export->width * 4;
+
+	for (int y = export->height - 1; y >= 0; y--)
+		fwrite(pixels + y * row, 1, row, export->out);
+}
+
+// Write out a frame in Y4M, full range BT.601 with 4:2:0 chroma
+void write_y4m(struct Export *export, const unsigned char *pixels)
+{
+	int width = export->width;
+	int height = export->height;
+	size_t row = (size_t) width * 4;
+
+	unsigned char *luma = export->planes;
+	unsigned char *cb = luma + width * height;
+	unsigned char *cr = cb + (width / 2) * (height / 2);
+
+	// Flipped upright on the way
+	for (int y = 0; y < height; y++) {
+		const unsigned char *in = pixels + (height - 1 - y) * row;
+		unsigned char *out = luma + y * width;
+
+		for (int x = 0; x < width; x++, in += 4)
+			out[x] = (77 * in[0] + 150 * in[1] + 29 * in[2] + 128) >> 8;
+	}
+
+	// Chroma of every two by two pixels, from the sums of their
+	// channels, offset so the arithmetic stays positive
+	for (int y = 0; y < height / 2; y++) {
+		const unsigned char *top = pixels + (height - 1 - 2 * y) * row;
+		const unsigned char *bottom = top - row;
+
+		for (int x = 0; x < width / 2; x++) {
+			const unsigned char *a = top + 8 * x;
+			const unsigned char *b = bottom + 8 * x;
+
+			int r = a[0] + a[4] + b[0] + b[4];
+			int g = a[1] + a[5] + b[1] + b[5];
+			int bl = a[2] + a[6] + b[2] + b[6];
+
+			int u = (-43 * r - 85 * g + 128 * bl + (128 << 10) + 512) >> 10;
+			int v = (128 * r - 107 * g - 21 * bl + (128 << 10) + 512) >> 10;
+
+			cb[y * (width / 2) + x] = u > 255 ? 255 : u;
+			cr[y * (width / 2) + x] = v > 255 ? 255 : v;
+		}
+	}
+
+	fputs("FRAME\n", export->out);
+	fwrite(export->planes, 1, width * height + 2 * (width / 2) * (height / 2), export->out);
+}
+
+// Write out the frame read back into a slot, waiting for the readback
+// if it is still running
+void write_slot(struct Export *export, int slot)
+{
+	GLsync fence = export->pixel_fence[slot];
+	while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 100000000) == GL_TIMEOUT_EXPIRED)
+		;
+	glDeleteSync(fence);
+	export->pixel_fence[slot] = NULL;
+
+	GLsizeiptr size = (GLsizeiptr) export->width * export->height * 4;
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, export->pixel_buffers[slot]);
+	const unsigned char *pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+
+	if (pixels != NULL) {
+		if (export->format == EXPORT_Y4M)
+			write_y4m(export, pixels);
+		else
+			write_rgba(export, pixels);
+
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	} else {
+		fprintf(stderr, "Failed to map exported frame %lu\n", export->frames);
+	}
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	export->frames++;
+}
+
+// Open the file frames are exported to. For stdout, everything else
+// printed there goes to stderr from now on, so it can't end up in
+// the stream.
+struct Export *open_export(const char *path, enum export_format format,
+		int width, int height, int framerate)
+{
+	struct Export *export = (struct Export *) malloc(sizeof(struct Export));
+
+	if (strcmp(path, "-") == 0) {
+		fflush(stdout);
+		int fd = dup(STDOUT_FILENO);
+		dup2(STDERR_FILENO, STDOUT_FILENO);
+		export->out = fd < 0 ? NULL : fdopen(fd, "wb");
+	} else {
+		export->out = fopen(path, "wb");
+	}
+
+	if (export->out == NULL) {
+		fprintf(stderr, "Failed to open %s for export\n", path);
+		free(export);
+		return NULL;
+	}
+
+	export->format = format;
+	export->width = width;
+	export->height = height;
+	export->next = 0;
+	export->pending = 0;
+	export->frames = 0;
+	export->planes = NULL;
+
+	// Stream header. The samples use the full range, which readers
+	// otherwise take to be limited range and stretch
+	if (format == EXPORT_Y4M) {
+		fprintf(export->out, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg XCOLORRANGE=FULL\n",
+			width, height, framerate);
+		export->planes = malloc(width * height + 2 * (width / 2) * (height / 2));
+	}
+
+	return export;
+}
+
+// Export the frames of a display, which must be the size of the export
+void attach_export(struct Display *display, struct Export *export)
+{
+	// Create the pixel buffers, only ever read from on this side
+	GLsizeiptr size = (GLsizeiptr) export->width * export->height * 4;
+
+	glGenBuffers(PIXEL_SLOTS, export->pixel_buffers);
+	for (int i = 0; i < PIXEL_SLOTS; i++) {
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, export->pixel_buffers[i]);
+		glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+		export->pixel_fence[i] = NULL;
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	// Rows of RGBA are always four byte aligned
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+	display->export = export;
+}
+
+// Queue the readback of the frame just rendered. It copies into a pixel
+// buffer on the GPU's time, the frame is only written out PIXEL_SLOTS
+// frames later when the slot comes around again.
+void export_frame(struct Export *export)
+{
+	int slot = export->next;
+
+	// The ring is full, the oldest frame goes out first
+	if (export->pending == PIXEL_SLOTS) {
+		write_slot(export, slot);
+		export->pending--;
+	}
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, export->pixel_buffers[slot]);
+	glReadPixels(0, 0, export->width, export->height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	export->pixel_fence[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+	export->next = (slot + 1) % PIXEL_SLOTS;
+	export->pending++;
+}
+
+// Write out what is still in flight, the display renders no more
+void finish_export(struct Display *display)
+{
+	struct Export *export = display->export;
+	display->export = NULL;
+
+	// Oldest first
+	while (export->pending > 0) {
+		int slot = (export->next - export->pending + PIXEL_SLOTS) % PIXEL_SLOTS;
+		write_slot(export, slot);
+		export->pending--;
+	}
+
+	fprintf(stderr, "Exported %lu frames\n", export->frames);
+
+	glDeleteBuffers(PIXEL_SLOTS, export->pixel_buffers);
+	free(export->planes);
+	fclose(export->out);
+
+	free(export);
+}
@@ -87,6 +87,54 @@ struct Shader load_shader(const char *vertex, const char *fragment)
 	return shader;
 }
 
+// Load a compute shader
+struct ComputeShader load_compute_shader(const char *compute)
+{
+	struct ComputeShader shader;
+
+	printf("Loading compute shader %s\n", compute);
+
+	char *compute_source = read_file(compute);
+
+	// Error handling
+	int success;
+	char info_log[512];
+
+	// Compile compute shader
+	shader.compute = glCreateShader(GL_COMPUTE_SHADER);
+	glShaderSource(shader.compute, 1, (const GLchar *const *)&compute_source, NULL);
+	glCompileShader(shader.compute);
+
+	// Check for errors
+	glGetShaderiv(shader.compute, GL_COMPILE_STATUS, &success);
+	if (!success) {
+		glGetShaderInfoLog(shader.compute, 512, NULL, info_log);
+		printf("Error compiling compute shader: %s\n", info_log);
+		exit(1);
+	}
+
+	// Create shader program
+	shader.program = glCreateProgram();
+	glAttachShader(shader.program, shader.compute);
+	glLinkProgram(shader.program);
+
+	// Check for errors
+	glGetProgramiv(shader.program, GL_LINK_STATUS, &success);
+	if (!success) {
+		glGetProgramInfoLog(shader.program, 512, NULL, info_log);
+		printf("Error linking compute shader program: %s\n", info_log);
+		exit(1);
+	}
+
+	// Delete shader
+	glDeleteShader(shader.compute);
+
+	// Free source
+	free(compute_source);
+
+	return shader;
+}
+
 // Create vertex array
 struct VertexArray make_vertex_array()
 {
@@ -146,6 +194,151 @@ struct Buffer make_buffer(GLuint type, GLuint binding, size_t size)
 	return buffer;
 }
 
+// Create a particle state texture, zeroed on the GPU so nothing the
+// size of the grid is uploaded
+GLuint make_particle_texture(GLenum internal_format, GLenum format, GLenum filter,
+		int width, int height)
+{
+	GLuint texture;
+
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+
+	glTexStorage2D(GL_TEXTURE_2D, 1, internal_format, width, height);
+	glClearTexImage(texture, 0, format, GL_HALF_FLOAT, NULL);
+
+	// Sampled past the edge by the bilinear fetch in the shade pass
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	return texture;
+}
+
+// (Re)allocate the particle grid when its size changed, zeroed
+void update_particle_grid(struct Display *display)
+{
+	int width = display->grid_width_setting;
+	int height = display->grid_height_setting;
+	if (width <= 0)
+		width = display->width;
+	if (height <= 0)
+		height = display->height;
+
+	if (width == display->grid_width && height == display->grid_height)
+		return;
+
+	printf("Particle grid %dx%d\n", width, height);
+
+	if (display->grid_width > 0) {
+		glDeleteTextures(2, display->particle_velocity);
+		glDeleteTextures(2, display->particle_level);
+	}
+
+	// Start from rest. Velocity is filtered for the shade pass, the
+	// level only read by the simulation
+	for (int i = 0; i < 2; i++) {
+		display->particle_velocity[i] = make_particle_texture(GL_RG16F, GL_RG, GL_LINEAR,
+			width, height);
+		display->particle_level[i] = make_particle_texture(GL_R16F, GL_RED, GL_NEAREST,
+			width, height);
+	}
+	display->particles_current = 0;
+
+	display->grid_width = width;
+	display->grid_height = height;
+}
+
+// Set the particle grid resolution, 0 to follow the framebuffer
+void set_particle_grid(struct Display *display, int width, int height)
+{
+	display->grid_width_setting = width;
+	display->grid_height_setting = height;
+	update_particle_grid(display);
+}
+
+// Follow the framebuffer size
+void framebuffer_size_callback(GLFWwindow *window, int width, int height)
+{
+	struct Display *display = glfwGetWindowUserPointer(window);
+
+	// Minimized
+	if (width <= 0 || height <= 0)
+		return;
+
+	display->width = width;
+	display->height = height;
+	glViewport(0, 0, width, height);
+
+	update_particle_grid(display);
+}
+
+// Create the ring of bar slots, mapped once for good
+void make_bar_ring(struct Display *display)
+{
+	// Slots are bound as ranges, which must start aligned
+	GLint alignment;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	display->bars_stride = (sizeof(struct BarSlot) + alignment - 1) / alignment * alignment;
+
+	GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	GLsizeiptr size = display->bars_stride * BAR_SLOTS;
+
+	glGenBuffers(1, &display->bars_buffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, display->bars_buffer);
+	glBufferStorage(GL_UNIFORM_BUFFER, size, NULL, flags);
+	display->bars_mapped = glMapBufferRange(GL_UNIFORM_BUFFER, 0, size, flags);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	if (display->bars_mapped == NULL) {
+		fprintf(stderr, "Failed to map the bar buffer\n");
+		exit(1);
+	}
+
+	// No bars to start with
+	memset(display->bars_mapped, 0, size);
+	for (int i = 0; i < BAR_SLOTS; i++)
+		display->bars_fence[i] = NULL;
+	display->bars_slot = 0;
+}
+
+struct BarSlot *bar_slot(struct Display *display, int slot)
+{
+	return (struct BarSlot *) (display->bars_mapped + slot * display->bars_stride);
+}
+
+// Values of the next frame of bars, once the GPU is done with the slot
+float *map_bars(struct Display *display)
+{
+	int slot = (display->bars_slot + 1) % BAR_SLOTS;
+
+	// Two frames back, so this rarely has to wait
+	GLsync fence = display->bars_fence[slot];
+	if (fence != NULL) {
+		while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 100000000) == GL_TIMEOUT_EXPIRED)
+			;
+		glDeleteSync(fence);
+		display->bars_fence[slot] = NULL;
+	}
+
+	return bar_slot(display, slot)->values;
+}
+
+// Draw from the bars written after map_bars
+void commit_bars(struct Display *display, int num_bars)
+{
+	int slot = (display->bars_slot + 1) % BAR_SLOTS;
+
+	if (num_bars > MAX_DISPLAY_BARS)
+		num_bars = MAX_DISPLAY_BARS;
+	bar_slot(display, slot)->num_bars = num_bars;
+
+	display->bars_slot = slot;
+}
+
 // Initialize GLFW and display structure
 struct Display *init_display(int width, int height, const char *title)
 {
@@ -171,9 +364,10 @@ struct Display *init_display(int width, int height, const char *title)
 		return NULL;
 	}
 
-	// Set the required OpenGL version
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+	// Set the required OpenGL version, 4.3 for compute shaders and
+	// 4.4 for persistently mapped buffers
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 4);
 
 	// Create a windowed mode window and its OpenGL context
 	display->window = glfwCreateWindow(
@@ -197,6 +391,9 @@ struct Display *init_display(int width, int height, const char *title)
 		return NULL;
 	}
 
+	// The framebuffer can be larger than the window, on high DPI screens
+	glfwGetFramebufferSize(display->window, &width, &height);
+
 	// Set the viewport size
 	glViewport(0, 0, width, height);
 
@@ -210,96 +407,277 @@ struct Display *init_display(int width, int height, const char *title)
 	display->width = width;
 	display->height = height;
 
-	display->num_bars = 0;
+	// The particle grid is allocated once the shaders are loaded
+	display->grid_width = 0;
+	display->grid_height = 0;
+	display->grid_width_setting = 0;
+	display->grid_height_setting = 0;
+
+	// Draw to the window
+	display->framebuffer = 0;
+	display->colorbuffer = 0;
+	display->export = NULL;
+
+	// Follow resizes
+	glfwSetWindowUserPointer(display->window, display);
+	glfwSetFramebufferSizeCallback(display->window, framebuffer_size_callback);
 
 	return display;
 }
 
-// Create and fully initialize a display context
-struct Display *make_display(int width, int height, const char *title)
+#ifdef HEADLESS
+
+// EGL display without any window system, with Mesa this runs on the GPU
+// or on llvmpipe where there is none
+EGLDisplay get_headless_egl_display()
 {
-	struct Display *display = init_display(width, height, title);
+	EGLDisplay egl_display = EGL_NO_DISPLAY;
+
+	const char *extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+	if (extensions != NULL && strstr(extensions, "EGL_MESA_platform_surfaceless") != NULL) {
+		PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+			(PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
 
+		if (get_platform_display != NULL)
+			egl_display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+	}
+
+	// Otherwise whatever the default is, it only needs pbuffers
+	if (egl_display == EGL_NO_DISPLAY)
+		egl_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+	return egl_display;
+}
+
+// Initialize EGL and a display structure drawing into a framebuffer object
+struct Display *init_headless_display(int width, int height)
+{
+	// Context to return
+	struct Display *display = (struct Display *) malloc(sizeof(struct Display));
+
+	display->debug = NULL;
+	display->window = NULL;
+
+	fprintf(stderr, "Initializing headless display\n");
+
+	// Initialize EGL
+	display->egl_display = get_headless_egl_display();
+	if (display->egl_display == EGL_NO_DISPLAY
+			|| !eglInitialize(display->egl_display, NULL, NULL)) {
+		fprintf(stderr, "Failed to initialize EGL\n");
+		return NULL;
+	}
+
+	if (!eglBindAPI(EGL_OPENGL_API)) {
+		fprintf(stderr, "EGL has no OpenGL support\n");
+		return NULL;
+	}
+
+	static const EGLint config_attributes[] = {
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_NONE
+	};
+
+	EGLConfig config;
+	EGLint configs;
+	if (!eglChooseConfig(display->egl_display, config_attributes, &config, 1, &configs)
+			|| configs < 1) {
+		fprintf(stderr, "Failed to find an EGL config\n");
+		return NULL;
+	}
+
+	// Set the required OpenGL version, as for the window
+	static const EGLint context_attributes[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 4,
+		EGL_CONTEXT_MINOR_VERSION, 4,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE
+	};
+
+	display->egl_context = eglCreateContext(display->egl_display, config,
+		EGL_NO_CONTEXT, context_attributes);
+	if (display->egl_context == EGL_NO_CONTEXT) {
+		fprintf(stderr, "Failed to create an OpenGL 4.4 context with EGL\n");
+		return NULL;
+	}
+
+	// Everything is drawn into a framebuffer object, so a surface is
+	// only made where the context can't be current without one
+	display->egl_surface = EGL_NO_SURFACE;
+
+	const char *extensions = eglQueryString(display->egl_display, EGL_EXTENSIONS);
+	if (extensions == NULL || strstr(extensions, "EGL_KHR_surfaceless_context") == NULL) {
+		static const EGLint surface_attributes[] = {
+			EGL_WIDTH, 1,
+			EGL_HEIGHT, 1,
+			EGL_NONE
+		};
+
+		display->egl_surface = eglCreatePbufferSurface(display->egl_display,
+			config, surface_attributes);
+	}
+
+	if (!eglMakeCurrent(display->egl_display, display->egl_surface,
+			display->egl_surface, display->egl_context)) {
+		fprintf(stderr, "Failed to make the EGL context current\n");
+		return NULL;
+	}
+
+	// Initialize GLAD
+	if (!gladLoadGLLoader((GLADloadproc) eglGetProcAddress)) {
+		fprintf(stderr, "Failed to initialize GLAD\n");
+		return NULL;
+	}
+
+	// Create the framebuffer drawn into instead of a window
+	glGenRenderbuffers(1, &display->colorbuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, display->colorbuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+
+	glGenFramebuffers(1, &display->framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, display->framebuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+		GL_RENDERBUFFER, display->colorbuffer);
+
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		fprintf(stderr, "Failed to create the offscreen framebuffer\n");
+		return NULL;
+	}
+
+	// It stays bound, for drawing and for reading back
+	glViewport(0, 0, width, height);
+
+	// Set the clear color
+	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+
+	// Set display context members, the size never changes
+	display->width = width;
+	display->height = height;
+
+	// The particle grid is allocated once the shaders are loaded
+	display->grid_width = 0;
+	display->grid_height = 0;
+	display->grid_width_setting = 0;
+	display->grid_height_setting = 0;
+
+	display->export = NULL;
+
+	return display;
+}
+
+#endif
+
+// Load the shaders and create everything drawn with
+void setup_display(struct Display *display)
+{
 	// Load shaders
 	static const char *vert_file = "display/shaders/visualizer.vert";
 	static const char *frag_file = "display/shaders/default.frag";
+	static const char *comp_file = "display/shaders/particles.comp";
 
 	struct Shader shader = load_shader(vert_file, frag_file);
 
 	display->shader = shader;
+	display->simulation = load_compute_shader(comp_file);
 
 	// Create vertex array
 	struct VertexArray array = make_vertex_array();
 
 	display->vertex_array = array;
 
-	// Create uniform buffers
-	size_t bars_size = sizeof(struct afloat) * (MAX_DISPLAY_BARS + 1);
-	struct Buffer bars_buffer = make_buffer(GL_UNIFORM_BUFFER, 0, bars_size);
-	display->bars_ubo = bars_buffer;
+	// Create the ring of bar slots
+	make_bar_ring(display);
 
-	size_t particles = width * height * sizeof(struct afloat);
+	// Create the particle grid, following the framebuffer until set otherwise
+	update_particle_grid(display);
+}
 
-	// Create temporary buffer to initialize particles
-	struct afloat *particles_buffer = (struct afloat *) malloc(particles);
-	for (int i = 0; i < width * height; i++) {
-		particles_buffer[i].value = 0.0f;
-		particles_buffer[i].x1 = 0.0f;
-		particles_buffer[i].x2 = 0.0f;
-		particles_buffer[i].x3 = 0.0f;
-	}
+// Create and fully initialize a display context
+struct Display *make_display(int width, int height, const char *title)
+{
+	struct Display *display = init_display(width, height, title);
+	if (display == NULL)
+		return NULL;
 
-	// Create uniform buffer for particles
-	display->particles_ubo_f1 = make_buffer(GL_SHADER_STORAGE_BUFFER, 1, particles);
-	display->particles_ubo_f2 = make_buffer(GL_SHADER_STORAGE_BUFFER, 2, particles);
+	setup_display(display);
 
-	// Copy particles to buffer
-	glBindBuffer(GL_UNIFORM_BUFFER, display->particles_ubo_f1.buffer);
-	glBufferSubData(GL_UNIFORM_BUFFER, 0, particles, particles_buffer);
-	glBindBuffer(GL_UNIFORM_BUFFER, 0);
-	
-	// Copy particles to buffer
-	glBindBuffer(GL_UNIFORM_BUFFER, display->particles_ubo_f2.buffer);
-	glBufferSubData(GL_UNIFORM_BUFFER, 0, particles, particles_buffer);
-	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	// Return the display context
+	return display;
+}
 
-	// Free temporary buffer
-	free(particles_buffer);
+// Create and fully initialize a display context without a window
+struct Display *make_headless_display(int width, int height)
+{
+#ifdef HEADLESS
+	struct Display *display = init_headless_display(width, height);
+	if (display == NULL)
+		return NULL;
+
+	setup_display(display);
 
 	// Return the display context
 	return display;
+#else
+	(void) width;
+	(void) height;
+
+	fprintf(stderr, "Built without EGL, can't render without a window\n");
+	return NULL;
+#endif
+}
+
+// Advance the particles by one step, from the current images into the others
+void simulate(struct Display *display)
+{
+	int src = display->particles_current;
+	int dst = 1 - src;
+
+	// Swap by binding, the shader always reads units 0 and 1 and
+	// writes 2 and 3
+	glBindImageTexture(0, display->particle_velocity[src], 0, GL_FALSE, 0,
+		GL_READ_ONLY, GL_RG16F);
+	glBindImageTexture(1, display->particle_level[src], 0, GL_FALSE, 0,
+		GL_READ_ONLY, GL_R16F);
+	glBindImageTexture(2, display->particle_velocity[dst], 0, GL_FALSE, 0,
+		GL_WRITE_ONLY, GL_RG16F);
+	glBindImageTexture(3, display->particle_level[dst], 0, GL_FALSE, 0,
+		GL_WRITE_ONLY, GL_R16F);
+
+	glUseProgram(display->simulation.program);
+	glUniform2i(0, display->grid_width, display->grid_height);
+	glUniform2i(1, display->width, display->height);
+
+	// One invocation per particle, in 16x16 tiles
+	glDispatchCompute((display->grid_width + 15) / 16, (display->grid_height + 15) / 16, 1);
+
+	// The shade pass samples what was just written, and the next
+	// simulation pass loads it
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+	display->particles_current = dst;
 }
 
 // Render a frame
 void render(struct Display *display)
 {
-	static int buf = 0;
-
 	// Clear the color buffer
 	glClear(GL_COLOR_BUFFER_BIT);
 
-	// Use the shader program
-	glUseProgram(display->shader.program);
+	// Draw from the newest bars, they are already in place
+	int slot = display->bars_slot;
+	glBindBufferRange(GL_UNIFORM_BUFFER, 0, display->bars_buffer,
+		slot * display->bars_stride, sizeof(struct BarSlot));
 
-	/* printf("Bars: %d\n", display->num_bars);
-	for (int i = 1; i <= display->num_bars; i++) {
-		printf("%f ", display->bars[i].value);
-	}
-	printf("\n"); */
+	// Run the particle simulation on the new bars
+	simulate(display);
 
-	// Copy to uniform buffer
-	// TODO: another function
-	glBindBuffer(GL_UNIFORM_BUFFER, display->bars_ubo.buffer);
+	// Use the shader program, it shades from the velocity just written
+	glUseProgram(display->shader.program);
+	glUniform2i(1, display->width, display->height);
 
-	buf = (buf + 1) % 2;
-	display->bars[0].value = display->num_bars;
-	display->bars[0].x1 = buf;
-
-	glBufferSubData(GL_UNIFORM_BUFFER, 0,
-		sizeof(struct afloat) * (display->num_bars + 1),
-		display->bars
-	);
-	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, display->particle_velocity[display->particles_current]);
 
 	// Bind vertex array
 	glBindVertexArray(display->vertex_array.vao);
@@ -307,6 +685,19 @@ void render(struct Display *display)
 	// Draw 6 vertices
 	glDrawArrays(GL_TRIANGLES, 0, 6);
 
+	// The slot is not written again before this frame is done with it
+	if (display->bars_fence[slot] != NULL)
+		glDeleteSync(display->bars_fence[slot]);
+	display->bars_fence[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+	// Read the frame back for export
+	if (display->export != NULL)
+		export_frame(display->export);
+
+	// Offscreen there is nothing to show
+	if (display->window == NULL)
+		return;
+
 	// Swap front and back buffers
 	glfwSwapBuffers(display->window);
 
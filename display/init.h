@@ -1,6 +1,7 @@
 // Standard headers
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
 
@@ -10,8 +11,20 @@
 // GLFW headers
 #include <GLFW/glfw3.h>
 
-// Max number of bars
-#define MAX_DISPLAY_BARS	1000
+// EGL headers, for rendering without a window
+#ifdef HEADLESS
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+// Max number of bars, as in the shaders
+#define MAX_DISPLAY_BARS	1024
+
+// Frames of bars in flight
+#define BAR_SLOTS		3
+
+// Exported frames in flight between rendering and writing out
+#define PIXEL_SLOTS		3
 
 // Shaders and loading
 struct Shader {
@@ -22,6 +35,14 @@ struct Shader {
 
 struct Shader load_shader(const char *, const char *);
 
+// Compute shaders
+struct ComputeShader {
+	GLuint		program;
+	GLuint		compute;
+};
+
+struct ComputeShader load_compute_shader(const char *);
+
 // Vertex array and buffer
 struct VertexArray {
 	GLuint	vao;
@@ -38,38 +59,95 @@ struct Buffer {
 
 struct Buffer make_buffer(GLuint, GLuint, size_t);
 
-// Aligned value
-struct afloat {
-	float value;
-	float x1;
-	float x2;
-	float x3;
-} __attribute__((aligned(16)));
+// One frame of bars as the shaders see it, a vec4 header with the
+// number of bars followed by the values packed four to a vec4
+struct BarSlot {
+	float	num_bars;
+	float	pad[3];
+	float	values[MAX_DISPLAY_BARS];
+};
+
+// Formats of exported frames
+enum export_format {
+	EXPORT_RGBA,
+	EXPORT_Y4M
+};
+
+// Export of every rendered frame to a file or pipe. Frames are read
+// back into a ring of pixel buffers and only written out once the ring
+// comes around to them, so the readback never stalls the frame that
+// asked for it.
+struct Export {
+	FILE *			out;
+	enum export_format	format;
+	int			width;
+	int			height;
+
+	// Pixel buffers, fenced by the readback into them
+	GLuint			pixel_buffers[PIXEL_SLOTS];
+	GLsync			pixel_fence[PIXEL_SLOTS];
+	int			next;
+	int			pending;
+
+	// Planes of a Y4M frame
+	unsigned char *		planes;
+
+	unsigned long		frames;
+};
 
 // Display context
 struct Display {
-	// Main window
+	// Main window, NULL when rendering offscreen
 	GLFWwindow *		window;
 
-	// Dimensions
+#ifdef HEADLESS
+	// EGL context when rendering offscreen
+	EGLDisplay		egl_display;
+	EGLContext		egl_context;
+	EGLSurface		egl_surface;
+#endif
+
+	// Offscreen target, 0 for the window
+	GLuint			framebuffer;
+	GLuint			colorbuffer;
+
+	// Export of the rendered frames, NULL for none
+	struct Export *		export;
+
+	// Dimensions of the framebuffer
 	int			width;
 	int			height;
 
+	// Dimensions of the particle grid, and the ones asked for,
+	// where 0 follows the framebuffer
+	int			grid_width;
+	int			grid_height;
+	int			grid_width_setting;
+	int			grid_height_setting;
+
 	// Shaders
 	struct Shader		shader;
+	struct ComputeShader	simulation;
 
 	// Vertex array
 	struct VertexArray	vertex_array;
 
-	// Uniform buffer
-	struct Buffer		bars_ubo;
-	struct Buffer		particles_ubo_f1;
-	struct Buffer		particles_ubo_f2;
+	// Bars, a ring of slots in one persistently mapped uniform buffer.
+	// Each slot is fenced by the last frame drawn from it, and only
+	// written again once that frame is done.
+	GLuint			bars_buffer;
+	char *			bars_mapped;
+	GLsizeiptr		bars_stride;
+	GLsync			bars_fence[BAR_SLOTS];
+	int			bars_slot;
 	struct Buffer		self;
 
-	// Bars
-	int32_t			num_bars;
-	struct afloat		bars[MAX_DISPLAY_BARS + 1];
+	// Particle state as half float images, the velocity and the bar
+	// level apart so the shade pass only fetches the velocity. One set
+	// is read and the other written by each simulation pass.
+	GLuint			particle_velocity[2];
+	GLuint			particle_level[2];
+	int			particles_current;
 
 	// Debug file
 	FILE *			debug;
@@ -78,5 +156,29 @@ struct Display {
 // Initialize display
 struct Display *make_display(int, int, const char *);
 
+// Initialize a display rendering offscreen, without a window
+struct Display *make_headless_display(int, int);
+
+// Open a file to export frames to, '-' for stdout. Opened before the
+// display is made, so nothing it prints ends up in the stream.
+struct Export *open_export(const char *, enum export_format, int, int, int);
+
+// Write every frame the display renders from now on to the export
+void attach_export(struct Display *, struct Export *);
+
+// Read back the frame just rendered
+void export_frame(struct Export *);
+
+// Write out the frames still in flight and close the file
+void finish_export(struct Display *);
+
+// Set the particle grid resolution, 0 to follow the framebuffer
+void set_particle_grid(struct Display *, int, int);
+
+// Values of the next frame of bars, written straight into GPU visible
+// memory, and making them the bars drawn from
+float *map_bars(struct Display *);
+void commit_bars(struct Display *, int);
+
 // Render a frame
 void render(struct Display *);
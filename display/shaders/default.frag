@@ -1,28 +1,23 @@
-#version 450
+#version 430
 
 // Inputs
-layout (location = 0) in vec2 point;
+layout (location = 0) in vec2 coord;
 
-// Uniform array of bars
+// Uniform array of bars, the number of bars in the first vec4 and the
+// values packed four to a vec4 after it
 #define MAX_DISPLAY_BARS 1024
 
 layout (std140, binding = 0) uniform Bars
 {
-	vec4	bars[MAX_DISPLAY_BARS + 1];
+	vec4	bars[1 + MAX_DISPLAY_BARS / 4];
 };
 
-// Uniform buffer of particles (double buffer)
-#define MAX_PARTICLES 1024 * 1024
+// Particle velocity written by the simulation pass of this frame. The grid
+// covers the whole framebuffer, linear filtering upsamples it.
+layout (binding = 0) uniform sampler2D velocity;
 
-layout (std140, binding = 1) buffer Particles_F1
-{
-	vec4	particles_f1[MAX_PARTICLES];
-};
-
-layout (std140, binding = 2) buffer Particles_F2
-{
-	vec4	particles_f2[MAX_PARTICLES];
-};
+// Size of the framebuffer, for its aspect ratio
+layout (location = 1) uniform ivec2 window;
 
 // Output is color
 layout (location = 0) out vec4 fragment;
@@ -30,28 +25,12 @@ layout (location = 0) out vec4 fragment;
 // PI constant
 const float PI = 3.1415926535897932384626433832795;
 
-// TODO: uniform values
-int win_width = 800;
-int win_height = 800;
-
-// Get data at 2D index
-vec4 get_data(int x, int y)
-{
-	// Check bounds
-	if (x < 0 || x >= win_width || y < 0 || y >= win_height)
-		return vec4(0.0, 0.0, 0.0, 0.0);
-
-	// Get index
-	int index = x + y * win_width;
-
-	// Return data
-	if (bars[0].y > 0.5)
-		return particles_f2[index];
-	return particles_f1[index];
-}
-
 void main()
 {
+	// Keep the circle round, in [-1, 1] along the shorter side
+	vec2 aspect = vec2(window) / float(min(window.x, window.y));
+	vec2 point = coord * aspect;
+
 	// Radius
 	float radius = length(point);
 
@@ -74,54 +53,15 @@ void main()
 	int i = int(theta / (2 * PI) * num_bars);
 
 	// Get the distance from the point to the bar
-	float value = bars[i + 1].x/2;
+	float value = bars[1 + i / 4][i % 4]/2;
 	float d = 0.3 + value;
 	if (length(point) < d) {
 		// Set the color
 		fragment = vec4(0.6, 1.0, 0.6, radius);
 	} else {
-		// Get buf index
-		float buf = bars[0].y;
-
-		// Normalize coordinates
-		float npx = (point.x + 1)/2;
-		float npy = (point.y + 1)/2;
-
-		// Get index of particle
-		int x = int(npx * win_width);
-		int y = int(npy * win_height);
-		int pi = x + y * win_width;
-
-		vec4 data = get_data(x, y);
-
-		// Velocity
-		vec2 v = data.xy;
-		vec2 dir = normalize(point);
-
-		// Calculate and apply bar force
-		float f = (value - data.z)/radius;
-		if (f > 0.0)
-			v += f * dir;
-
-		////////////////////////////////////////
-		// Calculate and apply pressure force //
-		////////////////////////////////////////
-
-		// Get data from neighbor particles
-		vec4 n1 = get_data(x - 1, y);
-		vec4 n2 = get_data(x + 1, y);
-		vec4 n3 = get_data(x, y - 1);
-		vec4 n4 = get_data(x, y + 1);
-
-		// Calculate pressure force
-		vec2 p = vec2(0.0, 0.0);
-		p += (n1.z - data.z) * normalize(vec2(n1.x, n1.y) - point);
-		p += (n2.z - data.z) * normalize(vec2(n2.x, n2.y) - point);
-		p += (n3.z - data.z) * normalize(vec2(n3.x, n3.y) - point);
-		p += (n4.z - data.z) * normalize(vec2(n4.x, n4.y) - point);
-
-		// Apply pressure force
-		v += p;
+		// Velocity of the particles here, bilinear between the four
+		// nearest so a coarse grid can be shaded at any resolution
+		vec2 v = texture(velocity, (coord + 1) / 2).xy;
 
 		// Color by velocity
 		float s = clamp(length(v), 0.0, 1.0);
@@ -129,12 +69,5 @@ void main()
 		vec3 c2 = vec3(0.665, 0.66, 0.878);
 		vec3 c = mix(c1, c2, s);
 		fragment = vec4(c, 1.0);
-
-		// Update particle
-		data = vec4(v, value, 0);
-		if (buf > 0.5)
-			particles_f1[pi] = data;
-		else
-			particles_f2[pi] = data;
 	}
 }
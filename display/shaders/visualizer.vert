@@ -1,4 +1,4 @@
-#version 450
+#version 430
 
 // Position input
 layout (location = 0) in vec2 position;
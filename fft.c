@@ -0,0 +1,356 @@
+#include "fft.h"
+#include "debug.h"
+
+#include <limits.h>
+#include <math.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef M_PI
+#define M_PI 3.1415926535897932385
+#endif
+
+// every set of FFT lengths planned so far. rates that share lengths share a
+// set, and going back to a rate that was seen before costs only a lookup.
+static struct fft_set *plan_cache;
+
+static unsigned int plan_flags = FFTW_MEASURE;
+static bool packed_stereo = false;
+static int plan_threads = 1;
+static int bass_resolution = BASS_RESOLUTION_HZ;
+
+// the fftw wisdom file in $XDG_CACHE_HOME/cava or ~/.cache/cava, one per precision,
+// optionally creating the directories on the way
+static bool wisdom_path(char path[PATH_MAX], bool create) {
+    const char *cache_home = getenv("XDG_CACHE_HOME");
+    if (cache_home != NULL) {
+        snprintf(path, PATH_MAX, "%s/%s", cache_home, PACKAGE);
+    } else {
+        const char *home = getenv("HOME");
+        if (home == NULL)
+            return false;
+        snprintf(path, PATH_MAX, "%s/.cache", home);
+        if (create)
+            mkdir(path, 0777);
+        snprintf(path, PATH_MAX, "%s/.cache/%s", home, PACKAGE);
+    }
+    if (create)
+        mkdir(path, 0777);
+    strncat(path, "/" FFTW_WISDOM_FILE, PATH_MAX - strlen(path) - 1);
+    return true;
+}
+
+// the number of threads fftw plans for. a plan made for one thread count keeps
+// it, so changing the count drops every cached plan. experimental, fft_threads
+// defaults to 1 until it is shown to scale on a multi-core machine.
+static void set_plan_threads(int threads) {
+    if (threads == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cores > 0 ? cores : 1;
+    }
+
+#ifdef FFT_THREADS
+    // must come before any other call into fftw
+    static int threads_ready = -1;
+    if (threads_ready < 0) {
+        threads_ready = FFTW(init_threads)() != 0;
+        if (!threads_ready)
+            debug("could not set up fftw threads, running the FFTs on one thread\n");
+    }
+    if (!threads_ready)
+        threads = 1;
+
+    if (threads != plan_threads)
+        fft_free_bands();
+    FFTW(plan_with_nthreads)(threads);
+#else
+    if (threads > 1)
+        debug("built without fftw threads, running the FFTs on one thread\n");
+    threads = 1;
+#endif
+
+    plan_threads = threads;
+}
+
+void fft_init(bool patient, bool packed, int threads, int bass_resolution_hz) {
+    static bool wisdom_loaded = false;
+    char path[PATH_MAX];
+
+    set_plan_threads(threads);
+
+    if (!wisdom_loaded && wisdom_path(path, false)) {
+        if (FFTW(import_wisdom_from_filename)(path))
+            debug("loaded fftw wisdom from %s\n", path);
+        wisdom_loaded = true;
+    }
+
+    plan_flags = patient ? FFTW_PATIENT : FFTW_MEASURE;
+    packed_stereo = packed;
+    bass_resolution = bass_resolution_hz;
+}
+
+int fft_size_for_rate(unsigned int rate, int resolution_hz) {
+    int size = FFT_MIN_SIZE;
+    while (size < FFT_MAX_SIZE && (double)rate / size > resolution_hz)
+        size <<= 1;
+    return size;
+}
+
+// spectra are size / 2 + 1 bins long, padding them to a multiple of four
+// keeps every band and both channels vector aligned
+static int padded_bins(int size) { return (size / 2 + 1 + 3) & ~3; }
+
+static void init_band(struct fft_set *set, struct fft_band *band, int size, int *in_offset,
+                      int *bin_offset) {
+    band->size = size;
+    band->bin_offset = *bin_offset;
+    band->in_l = set->input + *in_offset;
+    band->in_r = band->in_l + set->channel_samples;
+    band->out_l = set->spectrum + *bin_offset;
+    band->out_r = band->out_l + set->channel_bins;
+    *in_offset += size;
+    *bin_offset += padded_bins(size);
+
+    band->multiplier = FFTW(alloc_real)(size);
+    for (int i = 0; i < size; i++)
+        band->multiplier[i] = 0.5 * (1 - cos(2 * M_PI * i / (size - 1)));
+
+    band->plan_l = FFTW(plan_dft_r2c_1d)(size, band->in_l, band->out_l, plan_flags);
+    band->plan_lr = FFTW(plan_many_dft_r2c)(1, &size, 2, band->in_l, NULL, 1, set->channel_samples,
+                                            band->out_l, NULL, 1, set->channel_bins, plan_flags);
+}
+
+static struct fft_set *new_set(int bass_size, int mid_size, int treble_size) {
+    struct fft_set *set = calloc(1, sizeof(*set));
+    set->channel_samples = bass_size + mid_size + treble_size;
+    set->channel_bins = padded_bins(bass_size) + padded_bins(mid_size) + padded_bins(treble_size);
+    set->input = FFTW(alloc_real)(2 * set->channel_samples);
+    set->spectrum = FFTW(alloc_complex)(2 * set->channel_bins);
+    set->magnitude = FFTW(alloc_real)(2 * set->channel_bins);
+
+    int in_offset = 0, bin_offset = 0;
+    init_band(set, &set->bass, bass_size, &in_offset, &bin_offset);
+    init_band(set, &set->mid, mid_size, &in_offset, &bin_offset);
+    init_band(set, &set->treble, treble_size, &in_offset, &bin_offset);
+
+    // planning anything but FFTW_ESTIMATE overwrites the arrays
+    memset(set->input, 0, sizeof(sample_t) * 2 * set->channel_samples);
+    memset(set->spectrum, 0, sizeof(FFTW(complex)) * 2 * set->channel_bins);
+    memset(set->magnitude, 0, sizeof(sample_t) * 2 * set->channel_bins);
+
+    set->next = plan_cache;
+    plan_cache = set;
+
+    debug("planned FFTs of size %d, %d, %d on up to %d threads\n", bass_size, mid_size,
+          treble_size, plan_threads);
+    return set;
+}
+
+// left and right go in as the real and imaginary parts of one complex
+// transform. fftw takes them as separate arrays, so the windowed inputs
+// stay exactly where the unpacked plans read them.
+static void plan_packed(struct fft_band *band) {
+    int size = band->size;
+    band->packed_re = FFTW(alloc_real)(size);
+    band->packed_im = FFTW(alloc_real)(size);
+
+    FFTW(iodim) dim = {.n = size, .is = 1, .os = 1};
+    band->plan_packed = FFTW(plan_guru_split_dft)(1, &dim, 0, NULL, band->in_l, band->in_r,
+                                                  band->packed_re, band->packed_im, plan_flags);
+
+    memset(band->in_l, 0, sizeof(sample_t) * size);
+    memset(band->in_r, 0, sizeof(sample_t) * size);
+
+    debug("planned packed stereo FFT of size %d\n", size);
+}
+
+static struct fft_set *get_set(int bass_size, int mid_size, int treble_size, bool *planned) {
+    struct fft_set *set;
+    for (set = plan_cache; set; set = set->next) {
+        if (set->bass.size == bass_size && set->mid.size == mid_size &&
+            set->treble.size == treble_size)
+            break;
+    }
+
+    if (!set) {
+        set = new_set(bass_size, mid_size, treble_size);
+        *planned = true;
+    }
+    if (packed_stereo && !set->bass.plan_packed) {
+        plan_packed(&set->bass);
+        plan_packed(&set->mid);
+        plan_packed(&set->treble);
+        *planned = true;
+    }
+    return set;
+}
+
+// separates the spectra of the packed transform Z = FFT(l + i r) using the
+// symmetry of real signals:
+//   L[k] = (Z[k] + conj(Z[n - k])) / 2
+//   R[k] = (Z[k] - conj(Z[n - k])) / 2i
+// a straight loop over restrict pointers, left to the vectorizer
+static void split_packed(const struct fft_band *band) {
+    int n = band->size;
+    const sample_t *restrict re = band->packed_re;
+    const sample_t *restrict im = band->packed_im;
+    FFTW(complex) *restrict l = band->out_l;
+    FFTW(complex) *restrict r = band->out_r;
+    const sample_t half = 0.5;
+
+    l[0][0] = re[0];
+    l[0][1] = 0;
+    r[0][0] = im[0];
+    r[0][1] = 0;
+    for (int k = 1; k <= n / 2; k++) {
+        l[k][0] = (re[k] + re[n - k]) * half;
+        l[k][1] = (im[k] - im[n - k]) * half;
+        r[k][0] = (im[k] + im[n - k]) * half;
+        r[k][1] = (re[n - k] - re[k]) * half;
+    }
+}
+
+static void execute_band(const struct fft_band *band, bool stereo) {
+    if (stereo && packed_stereo) {
+        FFTW(execute)(band->plan_packed);
+        split_packed(band);
+        return;
+    }
+
+    FFTW(execute)(stereo ? band->plan_lr : band->plan_l);
+}
+
+static struct fft_set *get_set_for_rate(unsigned int rate, bool *planned) {
+    return get_set(fft_size_for_rate(rate, bass_resolution),
+                   fft_size_for_rate(rate, MID_RESOLUTION_HZ),
+                   fft_size_for_rate(rate, TREBLE_RESOLUTION_HZ), planned);
+}
+
+// keep what the planner learned for the next start, at worst it is measured again
+static void save_wisdom(void) {
+    char path[PATH_MAX];
+    if (wisdom_path(path, true)) {
+        if (!FFTW(export_wisdom_to_filename)(path))
+            debug("could not write fftw wisdom to %s\n", path);
+    }
+}
+
+static double elapsed_ms(const struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) * 1e3 + (end.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+// the rates inputs run at most. 44.1 and 48 kHz share their FFT lengths at the
+// default resolutions, 96 kHz has lengths of its own.
+static const unsigned int common_rates[] = {44100, 48000, 96000};
+
+double fft_plan_common_rates(void) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    bool planned = false;
+    for (size_t i = 0; i < sizeof(common_rates) / sizeof(common_rates[0]); i++)
+        get_set_for_rate(common_rates[i], &planned);
+    if (planned)
+        save_wisdom();
+
+    return elapsed_ms(&start);
+}
+
+double fft_select_bands(struct fft_bands *bands, struct audio_data *audio, unsigned int rate) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    bool planned = false;
+    struct fft_set *set = get_set_for_rate(rate, &planned);
+    bands->rate = rate;
+    bands->bass = &set->bass;
+    bands->mid = &set->mid;
+    bands->treble = &set->treble;
+    bands->spectrum = set->spectrum;
+    bands->magnitude = set->magnitude;
+    bands->channel_bins = set->channel_bins;
+
+    if (planned)
+        save_wisdom();
+
+    audio->FFTbassbufferSize = bands->bass->size;
+    audio->FFTmidbufferSize = bands->mid->size;
+    audio->FFTtreblebufferSize = bands->treble->size;
+    audio->bass_multiplier = bands->bass->multiplier;
+    audio->mid_multiplier = bands->mid->multiplier;
+    audio->treble_multiplier = bands->treble->multiplier;
+    audio->in_bass_l = bands->bass->in_l;
+    audio->in_bass_r = bands->bass->in_r;
+    audio->in_mid_l = bands->mid->in_l;
+    audio->in_mid_r = bands->mid->in_r;
+    audio->in_treble_l = bands->treble->in_l;
+    audio->in_treble_r = bands->treble->in_r;
+
+    // the inputs of the new bands may hold samples from whenever they were
+    // used last, make the next prepare window them again
+    audio->read_index = UINT64_MAX;
+
+    debug("%u Hz, FFT sizes %d, %d, %d\n", rate, audio->FFTbassbufferSize,
+          audio->FFTmidbufferSize, audio->FFTtreblebufferSize);
+
+    return elapsed_ms(&start);
+}
+
+void fft_execute(const struct fft_bands *bands, bool stereo) {
+    execute_band(bands->bass, stereo);
+    execute_band(bands->mid, stereo);
+    execute_band(bands->treble, stereo);
+}
+
+// one pass over every bin of the arena, padding included, without branches so
+// the compiler vectorizes it. the magnitudes stay far below where computing
+// them without hypot() could overflow.
+void fft_magnitudes(const struct fft_bands *bands, bool stereo) {
+    const sample_t *restrict bins = (const sample_t *)bands->spectrum;
+    sample_t *restrict out = bands->magnitude;
+    int count = bands->channel_bins * (stereo ? 2 : 1);
+
+    for (int i = 0; i < count; i++) {
+        sample_t re = bins[2 * i], im = bins[2 * i + 1];
+        out[i] = sample_sqrt(re * re + im * im);
+    }
+}
+
+void fft_bar_sums(const struct bar_table *table, const sample_t *restrict magnitude,
+                  sample_t *restrict out) {
+    for (int n = 0; n < table->bars; n++) {
+        sample_t sum = 0;
+        for (int i = table->first[n]; i <= table->last[n]; i++)
+            sum += magnitude[i];
+        out[n] = sum * table->weight[n];
+    }
+}
+
+static void free_band(struct fft_band *band) {
+    FFTW(destroy_plan)(band->plan_l);
+    FFTW(destroy_plan)(band->plan_lr);
+    if (band->plan_packed)
+        FFTW(destroy_plan)(band->plan_packed);
+    FFTW(free)(band->multiplier);
+    FFTW(free)(band->packed_re);
+    FFTW(free)(band->packed_im);
+}
+
+void fft_free_bands(void) {
+    while (plan_cache) {
+        struct fft_set *set = plan_cache;
+        plan_cache = set->next;
+
+        free_band(&set->bass);
+        free_band(&set->mid);
+        free_band(&set->treble);
+        FFTW(free)(set->input);
+        FFTW(free)(set->spectrum);
+        FFTW(free)(set->magnitude);
+        free(set);
+    }
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <fftw3.h>
+#include <math.h>
+#include <stdbool.h>
+
+#include "input/common.h"
+
+// fftw names for the precision of sample_t
+#ifdef FFT_FLOAT
+#define FFTW(name) fftwf_##name
+#define FFTW_WISDOM_FILE "fftwf_wisdom"
+#define sample_sqrt sqrtf
+#else
+#define FFTW(name) fftw_##name
+#define FFTW_WISDOM_FILE "fftw_wisdom"
+#define sample_sqrt sqrt
+#endif
+
+// bin width each band aims for, its FFT length follows from the sample rate.
+// at 44.1 kHz these give the classic 4096/2048/1024 split. the bass one is the
+// default of the bass_resolution option, which goes down to 1 Hz.
+#define BASS_RESOLUTION_HZ 12
+#define MID_RESOLUTION_HZ 24
+#define TREBLE_RESOLUTION_HZ 48
+
+// longest FFT, the bass band at a bass_resolution of 1 Hz from 44.1 kHz up.
+// the input ring is sized for it, so a rate change never has to touch the
+// capture side.
+#define FFT_MIN_SIZE 256
+#define FFT_MAX_SIZE 65536
+
+// one FFT length of a band set. its inputs and spectra live in the arenas of
+// the set, the right channel always one channel stride after the left.
+struct fft_band {
+    int size;
+    int bin_offset; // of the spectrum within a channel's part of the spectrum arena
+    sample_t *multiplier; // Hann window
+    sample_t *in_l, *in_r;
+    FFTW(complex) *out_l, *out_r;
+    FFTW(plan) plan_l;  // left channel only, for mono
+    FFTW(plan) plan_lr; // both channels in one call
+    // packed stereo, both channels in one complex transform
+    sample_t *packed_re, *packed_im;
+    FFTW(plan) plan_packed;
+};
+
+// the bands of one set of FFT lengths. all inputs share one aligned arena and
+// all spectra another, laid out as every band of the left channel followed by
+// every band of the right one.
+struct fft_set {
+    struct fft_band bass, mid, treble;
+    sample_t *input;
+    FFTW(complex) *spectrum;
+    sample_t *magnitude; // of every bin in the spectrum arena
+    int channel_samples, channel_bins; // per channel, including padding
+    struct fft_set *next;              // plan cache
+};
+
+// the bands in use at the current sample rate
+struct fft_bands {
+    unsigned int rate;
+    struct fft_band *bass, *mid, *treble;
+    FFTW(complex) *spectrum; // left channel, the right starts channel_bins later
+    sample_t *magnitude;     // same layout as the spectrum
+    int channel_bins;
+};
+
+// compressed row table mapping the magnitudes of one channel to bars. bar n
+// is the run of bins first[n] to last[n] in the arena, eq and averaging are
+// folded into weight[n]. built once per layout.
+struct bar_table {
+    int bars;
+    const int *first, *last;
+    const sample_t *weight;
+};
+
+int fft_size_for_rate(unsigned int rate, int resolution_hz);
+
+// loads the saved fftw wisdom on the first call. patient planning takes much
+// longer, but only once per FFT length since the result goes to the wisdom file.
+// packed runs stereo as one complex transform per band instead of two real ones.
+// threads lets fftw split a transform over that many threads, 0 for one per core,
+// when built with its threads library. must come before any other call into fftw,
+// allocations included. the bass band aims for bins bass_resolution_hz wide.
+void fft_init(bool patient, bool packed, int threads, int bass_resolution_hz);
+
+// plans the FFT lengths of 44.1, 48 and 96 kHz ahead, so that an input switching
+// to one of them later only has to look its plans up. returns the milliseconds
+// it took, most of a second on a cold start with FFTW_MEASURE, little once the
+// wisdom file has them.
+double fft_plan_common_rates(void);
+
+// switches to the bands for 'rate', planning any set of FFT lengths not seen
+// before, and points the windowing in audio at them. returns the milliseconds
+// it took. planning happens right here, so the first switch to a rate outside
+// the common ones takes as long as planning it does.
+double fft_select_bands(struct fft_bands *bands, struct audio_data *audio, unsigned int rate);
+
+void fft_execute(const struct fft_bands *bands, bool stereo);
+
+// magnitudes of the whole spectrum arena, of the left channel only unless stereo
+void fft_magnitudes(const struct fft_bands *bands, bool stereo);
+
+// weighted sum of each bar's run of magnitudes
+void fft_bar_sums(const struct bar_table *table, const sample_t *magnitude, sample_t *out);
+
+// destroys every cached plan, they are otherwise kept across config reloads
+void fft_free_bands(void);
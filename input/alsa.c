@@ -5,14 +5,27 @@
 
 #include <alloca.h>
 #include <alsa/asoundlib.h>
-#include <math.h>
 
 // assuming stereo
 #define CHANNELS_COUNT 2
 #define SAMPLE_RATE 44100
 
+// capture formats in order of preference, the wider ones first so sources
+// with more than 16 bits keep their dynamic range
+static const struct {
+    snd_pcm_format_t pcm_format;
+    enum input_format format;
+    int bits;
+} capture_formats[] = {
+    {SND_PCM_FORMAT_S32, FORMAT_S32, 32},
+    {SND_PCM_FORMAT_FLOAT, FORMAT_F32, 32},
+    {SND_PCM_FORMAT_S24_3LE, FORMAT_S24_3LE, 24},
+    {SND_PCM_FORMAT_S16, FORMAT_S16, 16},
+};
+
 static void initialize_audio_parameters(snd_pcm_t **handle, struct audio_data *audio,
-                                        snd_pcm_uframes_t *frames) {
+                                        snd_pcm_uframes_t *frames, enum input_format *format,
+                                        bool *mmap) {
     // alsa: open device to capture audio
     int err = snd_pcm_open(handle, audio->source, SND_PCM_STREAM_CAPTURE, 0);
     if (err < 0) {
@@ -24,143 +37,164 @@ static void initialize_audio_parameters(snd_pcm_t **handle, struct audio_data *a
     snd_pcm_hw_params_t *params;
     snd_pcm_hw_params_alloca(&params);      // assembling params
     snd_pcm_hw_params_any(*handle, params); // setting defaults or something
-    // interleaved mode right left right left
-    snd_pcm_hw_params_set_access(*handle, params, SND_PCM_ACCESS_RW_INTERLEAVED);
-    // trying to set 16bit
-    snd_pcm_hw_params_set_format(*handle, params, SND_PCM_FORMAT_S16_LE);
+    // interleaved mode right left right left, straight from the DMA area if the
+    // device allows it
+    *mmap = snd_pcm_hw_params_set_access(*handle, params, SND_PCM_ACCESS_MMAP_INTERLEAVED) == 0;
+    if (!*mmap)
+        snd_pcm_hw_params_set_access(*handle, params, SND_PCM_ACCESS_RW_INTERLEAVED);
+    // trying the widest sample format the device offers
+    int bits = 0;
+    for (size_t i = 0; i < sizeof(capture_formats) / sizeof(capture_formats[0]); i++) {
+        if (snd_pcm_hw_params_test_format(*handle, params, capture_formats[i].pcm_format) == 0) {
+            snd_pcm_hw_params_set_format(*handle, params, capture_formats[i].pcm_format);
+            *format = capture_formats[i].format;
+            bits = capture_formats[i].bits;
+            break;
+        }
+    }
+    if (bits == 0) {
+        fprintf(stderr, "no supported sample format, need S16, S24_3LE, S32 or FLOAT\n");
+        exit(EXIT_FAILURE);
+    }
     snd_pcm_hw_params_set_channels(*handle, params, CHANNELS_COUNT);
     unsigned int sample_rate = SAMPLE_RATE;
     // trying our rate
     snd_pcm_hw_params_set_rate_near(*handle, params, &sample_rate, NULL);
-    // number of frames pr read
+    // number of frames pr read, and optionally how many of them the device buffers
     snd_pcm_hw_params_set_period_size_near(*handle, params, frames, NULL);
+    if (audio->buffer_size) {
+        snd_pcm_uframes_t buffer_size = audio->buffer_size;
+        snd_pcm_hw_params_set_buffer_size_near(*handle, params, &buffer_size);
+    }
     err = snd_pcm_hw_params(*handle, params); // attempting to set params
     if (err < 0) {
         fprintf(stderr, "unable to set hw parameters: %s\n", snd_strerror(err));
         exit(EXIT_FAILURE);
     }
 
+    snd_pcm_hw_params_get_period_size(params, frames, NULL);
+    snd_pcm_hw_params_get_rate(params, &audio->rate, NULL);
+
+    // wake up once per period
+    snd_pcm_sw_params_t *sw_params;
+    snd_pcm_sw_params_alloca(&sw_params);
+    snd_pcm_sw_params_current(*handle, sw_params);
+    snd_pcm_sw_params_set_avail_min(*handle, sw_params, *frames);
+    if ((err = snd_pcm_sw_params(*handle, sw_params)) < 0) {
+        fprintf(stderr, "unable to set sw parameters: %s\n", snd_strerror(err));
+        exit(EXIT_FAILURE);
+    }
+
     if ((err = snd_pcm_prepare(*handle)) < 0) {
         fprintf(stderr, "cannot prepare audio interface for use (%s)\n", snd_strerror(err));
         exit(EXIT_FAILURE);
     }
 
-    // getting actual format
-    snd_pcm_hw_params_get_format(params, (snd_pcm_format_t *)&sample_rate);
-    // converting result to number of bits
-    if (sample_rate <= 5)
-        audio->format = 16;
-    else if (sample_rate <= 9)
-        audio->format = 24;
-    else
-        audio->format = 32;
-    snd_pcm_hw_params_get_rate(params, &audio->rate, NULL);
-    snd_pcm_hw_params_get_period_size(params, frames, NULL);
-    // snd_pcm_hw_params_get_period_time(params, &sample_rate, &dir);
+    audio->format = bits;
 }
 
-static int get_certain_frame(signed char *buffer, int buffer_index, int adjustment) {
-    // using the 10 upper bits this would give me a vert res of 1024, enough...
-    int temp = buffer[buffer_index + adjustment - 1] << 2;
-    int lo = buffer[buffer_index + adjustment - 2] >> 6;
-    if (lo < 0)
-        lo = abs(lo) + 1;
-    if (temp >= 0)
-        temp += lo;
-    else
-        temp -= lo;
-    return temp;
-}
-/*
-static void fill_audio_outs(struct audio_data* audio, signed char* buffer,
-const int size) {
-        int radj = audio->format / 4; // adjustments for interleaved
-        int ladj = audio->format / 8;
-        static int audio_out_buffer_index = 0;
-        // sorting out one channel and only biggest octet
-        for (int buffer_index = 0; buffer_index < size; buffer_index += ladj * 2) {
-                // first channel
-                int tempr = get_certain_frame(buffer, buffer_index, radj);
-                // second channel
-                int templ = get_certain_frame(buffer, buffer_index, ladj);
-
-                // mono: adding channels and storing it in the buffer
-                if (audio->channels == 1)
-                        audio->audio_out_l[audio_out_buffer_index] = (templ + tempr) / 2;
-                else { // stereo storing channels in buffer
-                        audio->audio_out_l[audio_out_buffer_index] = templ;
-                        audio->audio_out_r[audio_out_buffer_index] = tempr;
-                }
-
-                ++audio_out_buffer_index;
-                audio_out_buffer_index %= audio->FFTbufferSize;
-        }
+// gets the stream running again after an overrun or a suspend
+static void recover(snd_pcm_t *handle, struct audio_data *audio, int err, bool mmap) {
+    if (err == -EPIPE) {
+        /* EPIPE means overrun */
+        audio->xruns++;
+        debug("overrun occurred\n");
+    }
+    if ((err = snd_pcm_recover(handle, err, 1)) < 0) {
+        debug("could not recover from error: %s\n", snd_strerror(err));
+        return;
+    }
+    // capture in mmap mode does not start by itself on the first read
+    if (mmap)
+        snd_pcm_start(handle);
 }
-*/
 
-void *input_alsa(void *data) {
-    int err;
-    struct audio_data *audio = (struct audio_data *)data;
-    snd_pcm_t *handle;
-    snd_pcm_uframes_t buffer_size;
-    snd_pcm_uframes_t period_size;
-    snd_pcm_uframes_t frames = audio->FFTtreblebufferSize;
+// converts each ready period directly out of the device's DMA area
+static void capture_mmap(snd_pcm_t *handle, struct audio_data *audio, enum input_format format,
+                         snd_pcm_uframes_t period_size) {
+    snd_pcm_start(handle);
 
-    initialize_audio_parameters(&handle, audio, &frames);
-    snd_pcm_get_params(handle, &buffer_size, &period_size);
+    while (!audio->terminate) {
+        snd_pcm_sframes_t avail = snd_pcm_avail_update(handle);
+        if (avail < 0) {
+            recover(handle, audio, avail, true);
+            continue;
+        }
 
-    int radj = audio->format / 4; // adjustments for interleaved
-    int ladj = audio->format / 8;
-    int16_t buf[period_size];
-    int32_t buffer32[period_size];
-    frames = period_size / ((audio->format / 8) * CHANNELS_COUNT);
-    // printf("period size: %lu\n", period_size);
-    // exit(0);
+        if ((snd_pcm_uframes_t)avail < period_size) {
+            // sleeps until a period is complete, the timeout only lets us see terminate
+            int err = snd_pcm_wait(handle, 100);
+            if (err < 0)
+                recover(handle, audio, err, true);
+            continue;
+        }
 
-    // frames * bits/8 * channels
-    // const int size = frames * (audio->format / 8) * CHANNELS_COUNT;
-    signed char *buffer = malloc(period_size);
+        // the ready frames can wrap around the end of the DMA buffer, in
+        // which case mmap_begin hands them out in two parts
+        while (avail > 0) {
+            const snd_pcm_channel_area_t *areas;
+            snd_pcm_uframes_t offset, frames = avail;
 
-    while (!audio->terminate) {
-        switch (audio->format) {
-        case 16:
-            err = snd_pcm_readi(handle, buf, frames);
-            break;
-        case 32:
-            err = snd_pcm_readi(handle, buffer32, frames);
-            for (uint16_t i = 0; i < frames * 2; i++) {
-                buf[i] = buffer32[i] / pow(2, 16);
+            int err = snd_pcm_mmap_begin(handle, &areas, &offset, &frames);
+            if (err < 0) {
+                recover(handle, audio, err, true);
+                break;
             }
-            break;
-        default:
-            err = snd_pcm_readi(handle, buffer, frames);
-            // sorting out one channel and only biggest octet
-            for (uint16_t i = 0; i < period_size * 2; i += ladj * 2) {
-                // first channel
-                buf[i] = get_certain_frame(buffer, i, ladj);
-                // second channel
-                buf[i + 1] = get_certain_frame(buffer, i, radj);
+
+            // interleaved, so every channel shares the first area and frames are contiguous
+            const uint8_t *samples =
+                (const uint8_t *)areas[0].addr + (areas[0].first + offset * areas[0].step) / 8;
+            write_frames_to_input_buffers(frames, samples, format, audio);
+
+            snd_pcm_sframes_t committed = snd_pcm_mmap_commit(handle, offset, frames);
+            if (committed < 0 || (snd_pcm_uframes_t)committed != frames) {
+                recover(handle, audio, committed >= 0 ? -EPIPE : committed, true);
+                break;
             }
-            // fill_audio_outs(audio, buffer, period_size);
-            break;
+            avail -= frames;
         }
+    }
+}
+
+static void capture_read(snd_pcm_t *handle, struct audio_data *audio, enum input_format format,
+                         snd_pcm_uframes_t frames) {
+    // one period of interleaved frames in the device's own format
+    signed char *buffer = malloc(frames * input_format_bytes(format) * CHANNELS_COUNT);
 
-        if (err == -EPIPE) {
-            /* EPIPE means overrun */
-            debug("overrun occurred\n");
-            snd_pcm_prepare(handle);
-        } else if (err < 0) {
+    while (!audio->terminate) {
+        snd_pcm_sframes_t err = snd_pcm_readi(handle, buffer, frames);
+
+        if (err < 0) {
             debug("error from read: %s\n", snd_strerror(err));
-        } else if (err != (int)frames) {
-            debug("short read, read %d %d frames\n", err, (int)frames);
+            recover(handle, audio, err, false);
+            continue;
+        } else if (err != (snd_pcm_sframes_t)frames) {
+            debug("short read, read %d %d frames\n", (int)err, (int)frames);
         }
 
-        pthread_mutex_lock(&lock);
-        write_to_fftw_input_buffers(frames, buf, data);
-        pthread_mutex_unlock(&lock);
+        write_frames_to_input_buffers(err, buffer, format, audio);
     }
 
     free(buffer);
+}
+
+void *input_alsa(void *data) {
+    struct audio_data *audio = (struct audio_data *)data;
+    snd_pcm_t *handle;
+    snd_pcm_uframes_t frames = audio->block_frames;
+    if (audio->period_size)
+        frames = audio->period_size;
+    enum input_format format;
+    bool mmap;
+
+    initialize_audio_parameters(&handle, audio, &frames, &format, &mmap);
+    debug("alsa: %s capture, %lu frame periods\n", mmap ? "mmap" : "read", frames);
+
+    if (mmap)
+        capture_mmap(handle, audio, format, frames);
+    else
+        capture_read(handle, audio, format, frames);
+
     snd_pcm_close(handle);
     return NULL;
 }
@@ -2,90 +2,310 @@
 #include <math.h>
 
 #include <string.h>
+#include <time.h>
 
 void reset_output_buffers(struct audio_data *data) {
-    memset(data->in_bass_r, 0, sizeof(double) * data->FFTbassbufferSize);
-    memset(data->in_bass_l, 0, sizeof(double) * data->FFTbassbufferSize);
-    memset(data->in_mid_r, 0, sizeof(double) * data->FFTmidbufferSize);
-    memset(data->in_mid_l, 0, sizeof(double) * data->FFTmidbufferSize);
-    memset(data->in_treble_r, 0, sizeof(double) * data->FFTtreblebufferSize);
-    memset(data->in_treble_l, 0, sizeof(double) * data->FFTtreblebufferSize);
-    memset(data->in_bass_r_raw, 0, sizeof(double) * data->FFTbassbufferSize);
-    memset(data->in_bass_l_raw, 0, sizeof(double) * data->FFTbassbufferSize);
-    memset(data->in_mid_r_raw, 0, sizeof(double) * data->FFTmidbufferSize);
-    memset(data->in_mid_l_raw, 0, sizeof(double) * data->FFTmidbufferSize);
-    memset(data->in_treble_r_raw, 0, sizeof(double) * data->FFTtreblebufferSize);
-    memset(data->in_treble_l_raw, 0, sizeof(double) * data->FFTtreblebufferSize);
+    // move the index a whole ring ahead so the reader picks up the silence,
+    // reserving all of it first so a copy in progress sees it is overwritten
+    uint64_t w = __atomic_load_n(&data->write_index, __ATOMIC_RELAXED);
+    __atomic_store_n(&data->write_reserve, w + data->ring_size, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    memset(data->ring_l, 0, sizeof(sample_t) * data->ring_size);
+    memset(data->ring_r, 0, sizeof(sample_t) * data->ring_size);
+
+    __atomic_store_n(&data->write_index, w + data->ring_size, __ATOMIC_RELEASE);
 }
 
-int write_to_fftw_input_buffers(int16_t frames, int16_t buf[frames * 2], void *data) {
-    if (frames == 0)
-        return 0;
-    struct audio_data *audio = (struct audio_data *)data;
+int input_format_bytes(enum input_format format) {
+    switch (format) {
+    case FORMAT_S16:
+        return 2;
+    case FORMAT_S24_3LE:
+        return 3;
+    case FORMAT_S32:
+    case FORMAT_F32:
+        return 4;
+    }
+    return 0;
+}
 
-    for (uint16_t n = audio->FFTbassbufferSize; n > frames; n = n - frames) {
-        for (uint16_t i = 1; i <= frames; i++) {
-            audio->in_bass_l_raw[n - i] = audio->in_bass_l_raw[n - i - frames];
-            if (audio->channels == 2)
-                audio->in_bass_r_raw[n - i] = audio->in_bass_r_raw[n - i - frames];
-        }
+// All formats are scaled to the range of a 16 bit sample, which is what the
+// eq normalization in main expects, but without dropping the low bits.
+#define S32_SCALE ((sample_t)(1.0 / 65536))
+#define F32_SCALE ((sample_t)32768.0)
+
+static inline sample_t load_s16(const int16_t *in, int i) { return in[i]; }
+
+static inline sample_t load_s32(const int32_t *in, int i) { return in[i] * S32_SCALE; }
+
+static inline sample_t load_f32(const float *in, int i) { return in[i] * F32_SCALE; }
+
+// place the three bytes in the top of an int32 so the sign comes for free
+static inline sample_t load_s24_3le(const uint8_t *in, int i) {
+    const uint8_t *s = in + i * 3;
+    int32_t v = (int32_t)((uint32_t)s[2] << 24 | (uint32_t)s[1] << 16 | (uint32_t)s[0] << 8);
+    return v * S32_SCALE;
+}
+
+// deinterleaves 'frames' stereo frames into the ring slices l and r, mixing
+// down according to the mono option. every branch is a straight loop over
+// restrict pointers so the compiler can vectorize it.
+#define CONVERT_FRAMES(load, in)                                                                   \
+    do {                                                                                           \
+        if (audio->channels == 2) {                                                                \
+            for (int i = 0; i < frames; i++) {                                                     \
+                l[i] = load(in, i * 2);                                                            \
+                r[i] = load(in, i * 2 + 1);                                                        \
+            }                                                                                      \
+        } else if (audio->left) {                                                                  \
+            for (int i = 0; i < frames; i++)                                                       \
+                l[i] = load(in, i * 2);                                                            \
+        } else if (audio->right) {                                                                 \
+            for (int i = 0; i < frames; i++)                                                       \
+                l[i] = load(in, i * 2 + 1);                                                        \
+        } else {                                                                                   \
+            for (int i = 0; i < frames; i++)                                                       \
+                l[i] = (load(in, i * 2) + load(in, i * 2 + 1)) / 2;                                \
+        }                                                                                          \
+    } while (0)
+
+static void convert_frames(struct audio_data *audio, const void *buf, enum input_format format,
+                           int frames, sample_t *restrict l, sample_t *restrict r) {
+    switch (format) {
+    case FORMAT_S16:
+        CONVERT_FRAMES(load_s16, (const int16_t *restrict)buf);
+        break;
+    case FORMAT_S24_3LE:
+        CONVERT_FRAMES(load_s24_3le, (const uint8_t *restrict)buf);
+        break;
+    case FORMAT_S32:
+        CONVERT_FRAMES(load_s32, (const int32_t *restrict)buf);
+        break;
+    case FORMAT_F32:
+        CONVERT_FRAMES(load_f32, (const float *restrict)buf);
+        break;
     }
-    for (uint16_t n = audio->FFTmidbufferSize; n > frames; n = n - frames) {
-        for (uint16_t i = 1; i <= frames; i++) {
-            audio->in_mid_l_raw[n - i] = audio->in_mid_l_raw[n - i - frames];
-            if (audio->channels == 2)
-                audio->in_mid_r_raw[n - i] = audio->in_mid_r_raw[n - i - frames];
-        }
+}
+
+uint64_t input_clock_nsec(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// peak of a slice of a ring, folded into 'peak'
+static sample_t slice_peak(const sample_t *restrict in, int n, sample_t peak) {
+    for (int i = 0; i < n; i++) {
+        sample_t a = in[i] < 0 ? -in[i] : in[i];
+        peak = a > peak ? a : peak;
     }
-    for (uint16_t n = audio->FFTtreblebufferSize; n > frames; n = n - frames) {
-        for (uint16_t i = 1; i <= frames; i++) {
-            audio->in_treble_l_raw[n - i] = audio->in_treble_l_raw[n - i - frames];
-            if (audio->channels == 2)
-                audio->in_treble_r_raw[n - i] = audio->in_treble_r_raw[n - i - frames];
-        }
+    return peak;
+}
+
+// whether the block just converted to ring[start..] in two slices, the first
+// 'first' frames long, has anything above the noise floor. runs over samples
+// that are still in cache.
+static bool block_has_sound(struct audio_data *audio, uint32_t start, int first, int frames) {
+    sample_t peak = 0;
+    peak = slice_peak(audio->ring_l + start, first, peak);
+    peak = slice_peak(audio->ring_l, frames - first, peak);
+    if (audio->channels == 2) {
+        peak = slice_peak(audio->ring_r + start, first, peak);
+        peak = slice_peak(audio->ring_r, frames - first, peak);
     }
-    uint16_t n = frames - 1;
-    for (uint16_t i = 0; i < frames; i++) {
-        if (audio->channels == 1) {
-            if (audio->average) {
-                audio->in_bass_l_raw[n] = (buf[i * 2] + buf[i * 2 + 1]) / 2;
-            }
-            if (audio->left) {
-                audio->in_bass_l_raw[n] = buf[i * 2];
-            }
-            if (audio->right) {
-                audio->in_bass_l_raw[n] = buf[i * 2 + 1];
-            }
-        }
-        // stereo storing channels in buffer
-        if (audio->channels == 2) {
-            audio->in_bass_l_raw[n] = buf[i * 2];
-            audio->in_bass_r_raw[n] = buf[i * 2 + 1];
+    return peak > audio->noise_floor;
+}
 
-            audio->in_mid_r_raw[n] = audio->in_bass_r_raw[n];
-            audio->in_treble_r_raw[n] = audio->in_bass_r_raw[n];
-        }
+int write_frames_to_input_buffers(int frames, const void *buf, enum input_format format,
+                                  struct audio_data *audio) {
+    if (frames <= 0)
+        return 0;
 
-        audio->in_mid_l_raw[n] = audio->in_bass_l_raw[n];
-        audio->in_treble_l_raw[n] = audio->in_bass_l_raw[n];
-        n--;
+    // we are the only writer, so the index can be read without ordering
+    uint64_t w = __atomic_load_n(&audio->write_index, __ATOMIC_RELAXED);
+    uint32_t start = w & (audio->ring_size - 1);
+    int bytes_per_frame = input_format_bytes(format) * 2;
+
+    // a block longer than the ring only leaves its newest samples behind
+    if ((uint32_t)frames > audio->ring_size) {
+        buf = (const uint8_t *)buf + (frames - audio->ring_size) * bytes_per_frame;
+        start = (w + frames - audio->ring_size) & (audio->ring_size - 1);
+        w += frames - audio->ring_size;
+        frames = audio->ring_size;
     }
 
-    // Hann Window
-    for (int i = 0; i < audio->FFTbassbufferSize; i++) {
-        audio->in_bass_l[i] = audio->bass_multiplier[i] * audio->in_bass_l_raw[i];
-        if (audio->channels == 2)
-            audio->in_bass_r[i] = audio->bass_multiplier[i] * audio->in_bass_r_raw[i];
+    // announce how far this block reaches before touching the ring, a reader
+    // that finds its copy within that span after copying retries
+    __atomic_store_n(&audio->write_reserve, w + frames, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    // convert straight into the ring, in two slices if the block wraps around
+    int first = audio->ring_size - start;
+    if (first > frames)
+        first = frames;
+    convert_frames(audio, buf, format, first, audio->ring_l + start, audio->ring_r + start);
+    convert_frames(audio, (const uint8_t *)buf + first * bytes_per_frame, format, frames - first,
+                   audio->ring_l, audio->ring_r);
+    bool sound = block_has_sound(audio, start, first, frames);
+
+    // publish the new samples to the reader, and only then that they had sound
+    __atomic_store_n(&audio->write_index, w + frames, __ATOMIC_RELEASE);
+    __atomic_store_n(&audio->write_count, audio->write_count + 1, __ATOMIC_RELAXED);
+    if (sound) {
+        __atomic_store_n(&audio->last_sound_index, w + frames, __ATOMIC_RELAXED);
+        __atomic_store_n(&audio->last_sound_nsec, input_clock_nsec(), __ATOMIC_RELAXED);
     }
-    for (int i = 0; i < audio->FFTmidbufferSize; i++) {
-        audio->in_mid_l[i] = audio->mid_multiplier[i] * audio->in_mid_l_raw[i];
-        if (audio->channels == 2)
-            audio->in_mid_r[i] = audio->mid_multiplier[i] * audio->in_mid_r_raw[i];
+    return 0;
+}
+
+// last_sound_index is stored after write_index, but the input thread can
+// publish a block with sound between our two loads. then the sound is newer
+// than the end we loaded, which is anything but silent.
+bool input_is_silent(struct audio_data *audio) {
+    uint64_t end = __atomic_load_n(&audio->write_index, __ATOMIC_ACQUIRE);
+    uint64_t last = __atomic_load_n(&audio->last_sound_index, __ATOMIC_RELAXED);
+    if (last > end)
+        return false;
+    return end - last >= (uint64_t)audio->FFTbassbufferSize;
+}
+
+double input_silence_seconds(struct audio_data *audio) {
+    uint64_t last = __atomic_load_n(&audio->last_sound_nsec, __ATOMIC_RELAXED);
+    return (input_clock_nsec() - last) / 1e9;
+}
+
+int write_to_fftw_input_buffers(int16_t frames, int16_t buf[frames * 2], void *data) {
+    return write_frames_to_input_buffers(frames, buf, FORMAT_S16, (struct audio_data *)data);
+}
+
+// input threads that block in poll() also watch wakeup_pipe[0], so after
+// setting terminate the main loop can get them out without a timeout. a paced
+// input thread waits on pace_cond instead.
+void wake_input_thread(struct audio_data *audio) {
+    char c = 0;
+    write(audio->wakeup_pipe[1], &c, 1);
+
+    if (audio->paced)
+        input_notify(audio, false);
+}
+
+bool input_wait_for(struct audio_data *audio, uint64_t frames) {
+    pthread_mutex_lock(&audio->pace_lock);
+    audio->frames_allowed = frames;
+    pthread_cond_broadcast(&audio->pace_cond);
+    while (__atomic_load_n(&audio->write_index, __ATOMIC_ACQUIRE) < frames &&
+           !audio->end_of_input && !audio->terminate)
+        pthread_cond_wait(&audio->pace_cond, &audio->pace_lock);
+    bool reached = __atomic_load_n(&audio->write_index, __ATOMIC_ACQUIRE) >= frames;
+    pthread_mutex_unlock(&audio->pace_lock);
+    return reached;
+}
+
+uint64_t input_wait_for_room(struct audio_data *audio) {
+    pthread_mutex_lock(&audio->pace_lock);
+    while (audio->write_index >= audio->frames_allowed && !audio->terminate)
+        pthread_cond_wait(&audio->pace_cond, &audio->pace_lock);
+    uint64_t room = audio->terminate ? 0 : audio->frames_allowed - audio->write_index;
+    pthread_mutex_unlock(&audio->pace_lock);
+    return room;
+}
+
+void input_notify(struct audio_data *audio, bool end) {
+    pthread_mutex_lock(&audio->pace_lock);
+    if (end)
+        audio->end_of_input = true;
+    pthread_cond_broadcast(&audio->pace_cond);
+    pthread_mutex_unlock(&audio->pace_lock);
+}
+
+// 16 bytes per operation, two doubles or four floats, like vfloat in cava.c.
+// That is one SSE2 or NEON register, wider vectors get split in two on
+// the baseline targets and ran at half the speed for doubles.
+typedef sample_t vsample __attribute__((vector_size(16)));
+#define VSAMPLE_WIDTH ((int)(sizeof(vsample) / sizeof(sample_t)))
+
+// out[i] = in[i] * window[i], unaligned loads and stores go through memcpy
+static void apply_window(sample_t *restrict out, const sample_t *restrict in,
+                         const sample_t *restrict window, int size) {
+    int i = 0;
+    for (; i + VSAMPLE_WIDTH <= size; i += VSAMPLE_WIDTH) {
+        vsample a, w;
+        memcpy(&a, in + i, sizeof(a));
+        memcpy(&w, window + i, sizeof(w));
+        a *= w;
+        memcpy(out + i, &a, sizeof(a));
     }
-    for (int i = 0; i < audio->FFTtreblebufferSize; i++) {
-        audio->in_treble_l[i] = audio->treble_multiplier[i] * audio->in_treble_l_raw[i];
+    for (; i < size; i++)
+        out[i] = in[i] * window[i];
+}
+
+// windows the newest 'size' samples ending at 'end' out of a ring, the span
+// can wrap around the end of the ring so it is read as two contiguous slices
+static void window_from_ring(const sample_t *ring, uint32_t ring_size, uint64_t end, int size,
+                             const sample_t *window, sample_t *out) {
+    uint32_t start = (end - size) & (ring_size - 1);
+    uint32_t first = ring_size - start;
+    if (first > (uint32_t)size)
+        first = size;
+
+    apply_window(out, ring + start, window, first);
+    apply_window(out + first, ring, window + first, size - first);
+}
+
+static void window_channel(struct audio_data *audio, const sample_t *ring, uint64_t end,
+                           sample_t *bass, sample_t *mid, sample_t *treble) {
+    window_from_ring(ring, audio->ring_size, end, audio->FFTbassbufferSize,
+                     audio->bass_multiplier, bass);
+    window_from_ring(ring, audio->ring_size, end, audio->FFTmidbufferSize, audio->mid_multiplier,
+                     mid);
+    window_from_ring(ring, audio->ring_size, end, audio->FFTtreblebufferSize,
+                     audio->treble_multiplier, treble);
+}
+
+bool prepare_fftw_input_buffers(struct audio_data *audio) {
+    uint64_t end = __atomic_load_n(&audio->write_index, __ATOMIC_ACQUIRE);
+
+    // nothing new since the last frame, the windowed inputs are still current
+    if (end == audio->read_index) {
+        audio->snapshots_reused++;
+        return false;
+    }
+
+    // the input thread never waits for us, so it may lap the oldest samples we
+    // are copying. the reserve covers the block it is converting right now as
+    // well as everything published, if it reached into our span take a newer
+    // snapshot. after a few tries give up rather than stalling a frame, the
+    // inputs are torn then and the last spectrum has to do.
+    bool intact = false;
+    for (int attempt = 0; attempt < 3 && !intact; attempt++) {
+        window_channel(audio, audio->ring_l, end, audio->in_bass_l, audio->in_mid_l,
+                       audio->in_treble_l);
         if (audio->channels == 2)
-            audio->in_treble_r[i] = audio->treble_multiplier[i] * audio->in_treble_r_raw[i];
+            window_channel(audio, audio->ring_r, end, audio->in_bass_r, audio->in_mid_r,
+                           audio->in_treble_r);
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        uint64_t reserved = __atomic_load_n(&audio->write_reserve, __ATOMIC_RELAXED);
+        intact = reserved - end <= audio->ring_size - (uint64_t)audio->FFTbassbufferSize;
+
+        if (!intact) {
+            audio->snapshots_skipped++;
+            end = __atomic_load_n(&audio->write_index, __ATOMIC_ACQUIRE);
+        }
     }
-    return 0;
+
+    // read_index stays put, so the next prepare copies again
+    if (!intact)
+        return false;
+    audio->read_index = end;
+
+    // every block published after the one we read last, except the newest,
+    // was overwritten before the main loop got to see it on its own
+    uint64_t count = __atomic_load_n(&audio->write_count, __ATOMIC_RELAXED);
+    if (count - audio->read_count > 1)
+        audio->snapshots_skipped += count - audio->read_count - 1;
+    audio->read_count = count;
+
+    return true;
 }
@@ -11,29 +11,77 @@
 #include <string.h>
 #include <unistd.h>
 
+// precision of the analysis path from the input rings to the bar values,
+// single precision when built with --enable-float-fft
+#ifdef FFT_FLOAT
+typedef float sample_t;
+#else
+typedef double sample_t;
+#endif
+
+// sample formats accepted by the input buffers, always interleaved stereo
+enum input_format {
+    FORMAT_S16,     // signed 16 bit, native endian
+    FORMAT_S24_3LE, // signed 24 bit packed in three bytes, little endian
+    FORMAT_S32,     // signed 32 bit, native endian
+    FORMAT_F32,     // float in [-1, 1], native endian
+};
+
 struct audio_data {
+    // FFT lengths of the bands, for the main loop only. they follow the rate
+    // and change while the input thread runs.
     int FFTbassbufferSize;
     int FFTmidbufferSize;
     int FFTtreblebufferSize;
+    int block_frames; // frames the input thread reads at a time, fixed while it runs
     int bass_index;
     int mid_index;
     int treble_index;
-    double *bass_multiplier;
-    double *mid_multiplier;
-    double *treble_multiplier;
-    double *in_bass_r_raw, *in_bass_l_raw;
-    double *in_mid_r_raw, *in_mid_l_raw;
-    double *in_treble_r_raw, *in_treble_l_raw;
-    double *in_bass_r, *in_bass_l;
-    double *in_mid_r, *in_mid_l;
-    double *in_treble_r, *in_treble_l;
+    sample_t *bass_multiplier;
+    sample_t *mid_multiplier;
+    sample_t *treble_multiplier;
+    // capture history, one single-producer/single-consumer ring per channel.
+    // only the input thread writes to the rings and advances write_index,
+    // the main loop reads the newest samples of each band at FFT time.
+    // neither side ever waits for the other, the reader validates its copy
+    // against write_reserve afterwards, like a seqlock.
+    sample_t *ring_l, *ring_r;
+    uint32_t ring_size;     // power of two, at least twice the longest FFT
+    uint64_t write_index;   // frames written since start, never wraps
+    uint64_t write_reserve; // write_index the block being converted will publish, set first
+    uint64_t write_count; // blocks published by the input thread
+    uint64_t read_index;  // write_index at the last prepare, main loop only
+    uint64_t read_count;  // write_count at the last prepare, main loop only
+    unsigned long snapshots_reused;  // frames that found no new input
+    unsigned long snapshots_skipped; // blocks never seen by the main loop
+    // level of the input, kept by the input thread as it writes so silence
+    // takes no scan of the samples. a sample counts as sound above noise_floor.
+    sample_t noise_floor;
+    uint64_t last_sound_index; // write_index just past the last block with sound
+    uint64_t last_sound_nsec;  // input_clock_nsec() of the last block with sound
+    sample_t *in_bass_r, *in_bass_l;
+    sample_t *in_mid_r, *in_mid_l;
+    sample_t *in_treble_r, *in_treble_l;
     int format;
     unsigned int rate;
     char *source; // alsa device, fifo path or pulse source
     int im;       // input mode alsa, fifo or pulse
     unsigned int channels;
     bool left, right, average;
+    unsigned int target_latency_usec; // capture latency to ask the backend for
+    uint64_t latency_usec;            // capture latency reported by the backend, dates bar frames
+    unsigned int period_size, buffer_size; // device buffering in frames, 0 for default
+    unsigned long xruns;                   // overruns reported by the backend
+    // offline export. the input thread reads no further than frames_allowed,
+    // which the main loop raises one video frame at a time with input_wait_for,
+    // and ends the input at the end of its source instead of waiting for more.
+    bool paced;
+    uint64_t frames_allowed;
+    bool end_of_input;
+    pthread_mutex_t pace_lock;
+    pthread_cond_t pace_cond;
     int terminate; // shared variable used to terminate audio thread
+    int wakeup_pipe[2]; // written by wake_input_thread to interrupt a blocking poll()
     char error_message[1024];
 };
 
@@ -41,4 +89,35 @@ void reset_output_buffers(struct audio_data *data);
 
 int write_to_fftw_input_buffers(int16_t frames, int16_t buf[frames * 2], void *data);
 
-extern pthread_mutex_t lock;
+int write_frames_to_input_buffers(int frames, const void *buf, enum input_format format,
+                                  struct audio_data *audio);
+
+int input_format_bytes(enum input_format format);
+
+void wake_input_thread(struct audio_data *audio);
+
+// windows the newest samples into the FFT inputs. false if they hold nothing new,
+// either no audio arrived or the input thread kept overwriting the copy. the
+// inputs are then not fit to transform, the last spectrum still stands.
+bool prepare_fftw_input_buffers(struct audio_data *audio);
+
+// CLOCK_MONOTONIC in nanoseconds, the clock of last_sound_nsec
+uint64_t input_clock_nsec(void);
+
+// nothing above the noise floor within the newest bass window
+bool input_is_silent(struct audio_data *audio);
+
+// seconds since the input last delivered anything above the noise floor
+double input_silence_seconds(struct audio_data *audio);
+
+// paced input, main loop side: lets the input thread run up to 'frames' and waits
+// until it got there. false if the input ended or terminated short of it.
+bool input_wait_for(struct audio_data *audio, uint64_t frames);
+
+// paced input, input thread side: waits for the main loop to ask for more and
+// returns how many frames it may write, 0 once it should terminate
+uint64_t input_wait_for_room(struct audio_data *audio);
+
+// paced input, input thread side: after writing, and once more with 'end' set
+// when the source is exhausted or failed
+void input_notify(struct audio_data *audio, bool end);
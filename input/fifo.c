@@ -1,90 +1,169 @@
 #include "input/fifo.h"
 #include "input/common.h"
 
+#include <poll.h>
+#include <sys/stat.h>
 #include <time.h>
 
-int open_fifo(const char *path) {
-    int fd = open(path, O_RDONLY);
-    int flags = fcntl(fd, F_GETFL, 0);
-    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
-    return fd;
+// a writer that stays connected but sends nothing for this long is shown as silence
+#define FIFO_IDLE_TIMEOUT_MS 100
+
+// opening non-blocking returns right away even when no writer is connected yet,
+// waiting for one is left to poll() so the thread can still be woken up
+int open_fifo(const char *path) { return open(path, O_RDONLY | O_NONBLOCK); }
+
+// offline export: reads blocking and only as far as the main loop asks, so the
+// source is taken in exactly as fast as frames are rendered. '-' is stdin.
+// the end of the source is the end of the input.
+static void input_fifo_paced(struct audio_data *audio, enum input_format format, uint8_t *buf,
+                             size_t buf_size) {
+    int bytes_per_frame = input_format_bytes(format) * 2;
+
+    bool is_stdin = strcmp(audio->source, "-") == 0;
+    int fd = is_stdin ? STDIN_FILENO : open(audio->source, O_RDONLY);
+    if (fd < 0) {
+        sprintf(audio->error_message, __FILE__ ": could not open %s: %s\n", audio->source,
+                strerror(errno));
+        audio->terminate = 1;
+        input_notify(audio, true);
+        return;
+    }
+
+    // bytes of an incomplete frame carried over to the next read
+    unsigned int offset = 0;
+    uint64_t room;
+
+    while ((room = input_wait_for_room(audio)) > 0) {
+        size_t want = buf_size - buf_size % bytes_per_frame;
+        if (room * bytes_per_frame < want)
+            want = room * bytes_per_frame;
+
+        ssize_t num_read = read(fd, buf + offset, want - offset);
+        if (num_read < 0 && errno == EINTR)
+            continue;
+        if (num_read <= 0)
+            break;
+
+        offset += num_read;
+        int frames = offset / bytes_per_frame;
+        write_frames_to_input_buffers(frames, buf, format, audio);
+        memmove(buf, buf + frames * bytes_per_frame, offset - frames * bytes_per_frame);
+        offset -= frames * bytes_per_frame;
+        input_notify(audio, false);
+    }
+
+    input_notify(audio, true);
+
+    if (!is_stdin)
+        close(fd);
 }
 
 // input: FIFO
 void *input_fifo(void *data) {
     struct audio_data *audio = (struct audio_data *)data;
-    int SAMPLES_PER_BUFFER = audio->FFTtreblebufferSize * 2;
-    int bytes_per_sample = audio->format / 8;
-    __attribute__((aligned(sizeof(uint16_t)))) uint8_t buf[SAMPLES_PER_BUFFER * bytes_per_sample];
-    uint16_t *samples =
-        bytes_per_sample == 2 ? (uint16_t *)&buf : calloc(SAMPLES_PER_BUFFER, sizeof(uint16_t));
+    int SAMPLES_PER_BUFFER = audio->block_frames * 2;
+
+    enum input_format format = FORMAT_S16;
+    if (audio->format == 24)
+        format = FORMAT_S24_3LE;
+    else if (audio->format == 32)
+        format = FORMAT_S32;
+
+    int bytes_per_frame = input_format_bytes(format) * 2;
+    __attribute__((aligned(sizeof(uint32_t))))
+    uint8_t buf[SAMPLES_PER_BUFFER / 2 * bytes_per_frame];
+
+    if (audio->paced) {
+        input_fifo_paced(audio, format, buf, sizeof(buf));
+        return 0;
+    }
 
     int fd = open_fifo(audio->source);
 
+    struct stat st;
+    bool is_fifo = fd < 0 || (fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode));
+
     int test_mode = 0;
 
     if (strcmp(audio->source, "/dev/zero") == 0) {
         test_mode = 1;
     }
 
+    // bytes of an incomplete frame carried over to the next read
+    unsigned int offset = 0;
+    // block in poll() until data arrives, only wake up once to go silent when it stops.
+    // a source that does not exist yet is retried at the same interval.
+    int timeout = fd < 0 ? FIFO_IDLE_TIMEOUT_MS : -1;
+
     while (!audio->terminate) {
-        int time_since_last_input = 0;
-        unsigned int offset = 0;
-        do {
-            int num_read = read(fd, buf + offset, sizeof(buf) - offset);
-
-            if (num_read < 1) { // if no bytes read sleep 10ms and zero shared buffer
-                nanosleep(&(struct timespec){.tv_sec = 0, .tv_nsec = 10000000}, NULL);
-                time_since_last_input++;
-
-                if (time_since_last_input > 10) {
-                    reset_output_buffers(audio);
-                    close(fd);
-
-                    fd = open_fifo(audio->source);
-                    time_since_last_input = 0;
-                    offset = 0;
-                }
-            } else {
-                offset += num_read;
-                time_since_last_input = 0;
-            }
-        } while (offset < sizeof(buf));
+        struct pollfd fds[2] = {
+            {.fd = fd, .events = POLLIN},
+            {.fd = audio->wakeup_pipe[0], .events = POLLIN},
+        };
 
-        switch (bytes_per_sample) {
-        case 2:
-            // [samples] = [buf] so there's nothing to do here.
+        int ready = poll(fds, 2, timeout);
+        if (ready < 0) {
+            if (errno == EINTR)
+                continue;
+            sprintf(audio->error_message, __FILE__ ": poll() failed: %s\n", strerror(errno));
+            audio->terminate = 1;
             break;
-        case 3:
-            for (int i = 0; i < SAMPLES_PER_BUFFER; i++) {
-                // Really, a sample is composed of buf[3i + 2] | buf[3i + 1] | buf[3i], but our FFT
-                // only takes 16-bit samples. Since we need to scale them eventually, we can just
-                // do so here by taking the top 2 bytes.
-                samples[i] = (buf[3 * i + 2] << 8) | buf[3 * i + 1];
-            }
+        }
+
+        // woken up by the main loop, terminate is set
+        if (fds[1].revents)
             break;
-        case 4:
-            for (int i = 0; i < SAMPLES_PER_BUFFER; i++) {
-                samples[i] = (buf[4 * i + 3] << 8) | buf[4 * i + 2];
+
+        if (ready == 0) {
+            if (fd < 0) {
+                fd = open_fifo(audio->source);
+                timeout = fd < 0 ? FIFO_IDLE_TIMEOUT_MS : -1;
+                continue;
             }
-            break;
+            // the writer is still there but went quiet
+            reset_output_buffers(audio);
+            timeout = -1;
+            continue;
         }
 
-        // We worked with unsigned ints up until now to save on sign extension, but the FFT wants
-        // signed ints.
-        pthread_mutex_lock(&lock);
-        write_to_fftw_input_buffers(SAMPLES_PER_BUFFER / 2, (int16_t *)samples, audio);
-        pthread_mutex_unlock(&lock);
-        if (test_mode) {
-            nanosleep(&(struct timespec){.tv_sec = 0, .tv_nsec = 1000000},
-                      NULL); // sleep 1 ms to prevent deadlock reading from /dev/zero
+        ssize_t num_read = 0;
+        if (fds[0].revents & POLLIN) {
+            num_read = read(fd, buf + offset, sizeof(buf) - offset);
+            if (num_read < 0 && (errno == EAGAIN || errno == EINTR))
+                continue;
         }
-    }
 
-    close(fd);
-    if (bytes_per_sample != 2) {
-        free(samples);
+        if (num_read > 0) {
+            // hand over every complete frame right away instead of waiting for a full buffer
+            offset += num_read;
+            int frames = offset / bytes_per_frame;
+            write_frames_to_input_buffers(frames, buf, format, audio);
+            memmove(buf, buf + frames * bytes_per_frame, offset - frames * bytes_per_frame);
+            offset -= frames * bytes_per_frame;
+            timeout = FIFO_IDLE_TIMEOUT_MS;
+
+            if (test_mode) {
+                nanosleep(&(struct timespec){.tv_sec = 0, .tv_nsec = 1000000},
+                          NULL); // sleep 1 ms to prevent deadlock reading from /dev/zero
+            }
+        } else {
+            // the writer hung up. reopen, so poll() blocks until the next writer
+            // connects instead of reporting the hangup over and over
+            reset_output_buffers(audio);
+            close(fd);
+
+            // a regular file is always readable, don't spin on its end
+            if (!is_fifo)
+                nanosleep(&(struct timespec){.tv_sec = 0, .tv_nsec = 100000000}, NULL);
+
+            fd = open_fifo(audio->source);
+            offset = 0;
+            timeout = fd < 0 ? FIFO_IDLE_TIMEOUT_MS : -1;
+        }
     }
 
+    if (fd >= 0)
+        close(fd);
+
     return 0;
 }
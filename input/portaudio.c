@@ -37,15 +37,11 @@ static int recordCallback(const void *inputBuffer, void *outputBuffer,
         finished = paContinue;
     }
 
-    pthread_mutex_lock(&lock);
-
     if (inputBuffer == NULL)
         write_to_fftw_input_buffers(framesToCalc, silence_buffer, audio);
     else
         write_to_fftw_input_buffers(framesToCalc, rptr, audio);
 
-    pthread_mutex_unlock(&lock);
-
     data->frameIndex += framesToCalc;
     if (finished == paComplete) {
         data->frameIndex = 0;
@@ -125,7 +121,7 @@ void *input_portaudio(void *audiodata) {
     inputParameters.device = deviceNum;
 
     // set parameters
-    data.maxFrameIndex = audio->FFTtreblebufferSize * 1024;
+    data.maxFrameIndex = audio->block_frames * 1024;
     data.recordedSamples = (SAMPLE *)malloc(2 * data.maxFrameIndex * sizeof(SAMPLE));
     if (data.recordedSamples == NULL) {
         fprintf(stderr, "Error: failure in memory allocation!\n");
@@ -140,7 +136,7 @@ void *input_portaudio(void *audiodata) {
     inputParameters.hostApiSpecificStreamInfo = NULL;
 
     // set it to work
-    err = Pa_OpenStream(&stream, &inputParameters, NULL, audio->rate, audio->FFTtreblebufferSize,
+    err = Pa_OpenStream(&stream, &inputParameters, NULL, audio->rate, audio->block_frames,
                         paClipOff, recordCallback, &data);
     if (err != paNoError) {
         fprintf(stderr, "Error: failure in opening stream (%x)\n", err);
@@ -1,9 +1,9 @@
 #include "input/pulse.h"
+#include "debug.h"
 #include "input/common.h"
 
 #include <pulse/error.h>
 #include <pulse/pulseaudio.h>
-#include <pulse/simple.h>
 
 pa_mainloop *m_pulseaudio_mainloop;
 
@@ -96,51 +96,147 @@ void getPulseDefaultSink(void *data) {
     pa_mainloop_run(m_pulseaudio_mainloop, &ret);
 }
 
-void *input_pulse(void *data) {
+// state shared by the callbacks of the capture stream
+struct pulse_capture {
+    struct audio_data *audio;
+    pa_mainloop *mainloop;
+    pa_stream *stream;
+};
 
-    struct audio_data *audio = (struct audio_data *)data;
-    uint16_t frames = audio->FFTtreblebufferSize;
-    int channels = 2;
-    int16_t buf[frames * channels];
+static const pa_sample_spec capture_spec = {
+    .format = PA_SAMPLE_FLOAT32NE, .rate = 44100, .channels = 2};
 
-    /* The sample type to use */
-    static const pa_sample_spec ss = {.format = PA_SAMPLE_S16LE, .rate = 44100, .channels = 2};
+static void capture_error(struct pulse_capture *capture, const char *what, int error) {
+    sprintf(capture->audio->error_message, __FILE__ ": %s: %s\n", what, pa_strerror(error));
+    capture->audio->terminate = 1;
+    pa_mainloop_quit(capture->mainloop, 1);
+}
 
-    audio->format = 16;
+static void stream_read_callback(pa_stream *stream, __attribute__((unused)) size_t nbytes,
+                                 void *userdata) {
+    struct pulse_capture *capture = (struct pulse_capture *)userdata;
+    const void *samples;
+    size_t length;
+
+    // read the fragments in place from the server's memblocks, no extra copy
+    while (pa_stream_readable_size(stream) > 0) {
+        if (pa_stream_peek(stream, &samples, &length) < 0) {
+            capture_error(capture, "pa_stream_peek() failed",
+                          pa_context_errno(pa_stream_get_context(stream)));
+            return;
+        }
+        if (length == 0)
+            break;
+
+        // a NULL pointer with a length is a hole in the stream, skip it
+        if (samples != NULL)
+            write_frames_to_input_buffers(length / pa_frame_size(&capture_spec), samples,
+                                          FORMAT_F32, capture->audio);
+        pa_stream_drop(stream);
+    }
 
-    const int frag_size = frames * channels * audio->format / 8 *
-                          2; // we double this because of cpu performance issues with pulseaudio
+    pa_usec_t latency;
+    int negative;
+    if (pa_stream_get_latency(stream, &latency, &negative) == 0)
+        __atomic_store_n(&capture->audio->latency_usec, negative ? 0 : latency,
+                         __ATOMIC_RELAXED);
+}
 
-    pa_buffer_attr pb = {.maxlength = (uint32_t)-1, // BUFSIZE * 2,
-                         .fragsize = frag_size};
+static void stream_state_callback(pa_stream *stream, void *userdata) {
+    struct pulse_capture *capture = (struct pulse_capture *)userdata;
 
-    pa_simple *s = NULL;
-    int error;
+    switch (pa_stream_get_state(stream)) {
+    case PA_STREAM_READY:
+        debug("pulse: recording with %u byte fragments\n",
+              pa_stream_get_buffer_attr(stream)->fragsize);
+        break;
+    case PA_STREAM_FAILED:
+        capture_error(capture, "Could not open pulseaudio source",
+                      pa_context_errno(pa_stream_get_context(stream)));
+        break;
+    default:
+        break;
+    }
+}
 
-    if (!(s = pa_simple_new(NULL, "cava", PA_STREAM_RECORD, audio->source, "audio for cava", &ss,
-                            NULL, &pb, &error))) {
-        sprintf(audio->error_message, __FILE__ ": Could not open pulseaudio source: %s, %s. \
-		To find a list of your pulseaudio sources run 'pacmd list-sources'\n",
-                audio->source, pa_strerror(error));
+static void context_state_callback(pa_context *context, void *userdata) {
+    struct pulse_capture *capture = (struct pulse_capture *)userdata;
+    struct audio_data *audio = capture->audio;
 
-        audio->terminate = 1;
-        pthread_exit(NULL);
-        return 0;
+    switch (pa_context_get_state(context)) {
+    case PA_CONTEXT_READY: {
+        capture->stream = pa_stream_new(context, "audio for cava", &capture_spec, NULL);
+        if (!capture->stream) {
+            capture_error(capture, "pa_stream_new() failed", pa_context_errno(context));
+            return;
+        }
+        pa_stream_set_state_callback(capture->stream, stream_state_callback, capture);
+        pa_stream_set_read_callback(capture->stream, stream_read_callback, capture);
+
+        // ask the server for fragments of the target latency instead of its
+        // default, which can be up to two seconds for a record stream
+        pa_buffer_attr attr = {
+            .maxlength = (uint32_t)-1,
+            .fragsize = pa_usec_to_bytes(audio->target_latency_usec, &capture_spec),
+        };
+        pa_stream_flags_t flags =
+            PA_STREAM_ADJUST_LATENCY | PA_STREAM_AUTO_TIMING_UPDATE | PA_STREAM_INTERPOLATE_TIMING;
+
+        if (pa_stream_connect_record(capture->stream, audio->source, &attr, flags) < 0)
+            capture_error(capture, "pa_stream_connect_record() failed", pa_context_errno(context));
+        break;
     }
+    case PA_CONTEXT_FAILED:
+        capture_error(capture, "lost connection to pulseaudio server", pa_context_errno(context));
+        break;
+    case PA_CONTEXT_TERMINATED:
+        // pa_context_disconnect on the way out, not an error
+        pa_mainloop_quit(capture->mainloop, 0);
+        break;
+    default:
+        break;
+    }
+}
 
-    while (!audio->terminate) {
-        if (pa_simple_read(s, buf, sizeof(buf), &error) < 0) {
-            sprintf(audio->error_message, __FILE__ ": pa_simple_read() failed: %s\n",
-                    pa_strerror(error));
-            audio->terminate = 1;
-        }
+// the main loop writes to the wakeup pipe after setting terminate
+static void wakeup_callback(pa_mainloop_api *api, pa_io_event *event,
+                            __attribute__((unused)) int fd,
+                            __attribute__((unused)) pa_io_event_flags_t events, void *userdata) {
+    api->io_free(event);
+    pa_mainloop_quit((pa_mainloop *)userdata, 0);
+}
+
+void *input_pulse(void *data) {
+
+    struct audio_data *audio = (struct audio_data *)data;
+    struct pulse_capture capture = {.audio = audio};
+
+    audio->format = 32;
+
+    capture.mainloop = pa_mainloop_new();
+    pa_mainloop_api *api = pa_mainloop_get_api(capture.mainloop);
+    api->io_new(api, audio->wakeup_pipe[0], PA_IO_EVENT_INPUT, wakeup_callback, capture.mainloop);
+
+    pa_context *context = pa_context_new(api, "cava");
+    pa_context_set_state_callback(context, context_state_callback, &capture);
+
+    if (pa_context_connect(context, NULL, PA_CONTEXT_NOFLAGS, NULL) < 0) {
+        sprintf(audio->error_message, __FILE__ ": Could not connect to pulseaudio: %s\n",
+                pa_strerror(pa_context_errno(context)));
+        audio->terminate = 1;
+    } else {
+        // everything happens in the callbacks from here on
+        pa_mainloop_run(capture.mainloop, NULL);
+    }
 
-        pthread_mutex_lock(&lock);
-        write_to_fftw_input_buffers(frames, buf, data);
-        pthread_mutex_unlock(&lock);
+    if (capture.stream) {
+        pa_stream_disconnect(capture.stream);
+        pa_stream_unref(capture.stream);
     }
+    pa_context_disconnect(context);
+    pa_context_unref(context);
+    pa_mainloop_free(capture.mainloop);
 
-    pa_simple_free(s);
     pthread_exit(NULL);
     return 0;
 }
@@ -1,5 +1,6 @@
 #include "input/shmem.h"
 #include "input/common.h"
+#include "util.h"
 
 #include <sys/mman.h>
 #include <sys/stat.h>
@@ -7,7 +8,6 @@
 
 typedef unsigned int u32_t;
 typedef short s16_t;
-int rc;
 
 // See issue #375
 // Hard-coded in squeezelite's output_vis.c, but
@@ -25,20 +25,19 @@ typedef struct {
     s16_t buffer[VIS_BUF_SIZE];
 } vis_t;
 
+// read whenever about this many new frames should be waiting
+#define SHMEM_CHUNK_FRAMES 512
+// poll interval while squeezelite is not playing
+#define SHMEM_IDLE_NSEC 100000000
+
 // input: SHMEM
 void *input_shmem(void *data) {
     struct audio_data *audio = (struct audio_data *)data;
     vis_t *mmap_area;
     int fd; /* file descriptor to mmaped area */
     int mmap_count = sizeof(vis_t);
-    int buf_frames;
-    int fftw_frames = audio->FFTtreblebufferSize;
     struct timespec req = {.tv_sec = 0, .tv_nsec = 0};
-    int16_t buf[fftw_frames * 2];
-
-    s16_t silence_buffer[fftw_frames * 2];
-    for (int i = 0; i < fftw_frames * 2; i++)
-        silence_buffer[i] = 0;
+    s16_t buf[VIS_BUF_SIZE];
 
     // printf("input_shmem: source: %s", audio->source);
 
@@ -56,31 +55,70 @@ void *input_shmem(void *data) {
         }
     }
 
+    // squeezelite writes interleaved samples at buffer[buf_index] and then
+    // advances buf_index, wrapping at buf_size. we remember where we stopped
+    // reading and only copy what was written since.
+    u32_t last_index = 0;
+    u32_t last_size = 0;
+    bool was_running = false;
+
     while (!audio->terminate) {
+        // squeezelite holds the write lock only while copying a period, never block on it
+        if (pthread_rwlock_tryrdlock(&mmap_area->rwlock) != 0) {
+            nanosleep(&(struct timespec){.tv_sec = 0, .tv_nsec = 1000000}, NULL);
+            continue;
+        }
+
+        bool running = mmap_area->running;
+        u32_t rate = mmap_area->rate;
+        u32_t buf_size = mmap_area->buf_size;
+        u32_t index = mmap_area->buf_index;
+        u32_t samples = 0;
+
+        if (buf_size > VIS_BUF_SIZE)
+            buf_size = VIS_BUF_SIZE;
+
+        if (running && index < buf_size) {
+            // don't replay what was left from the last song. a buffer that changed
+            // size is started over too, the old position may lie beyond its end.
+            if (!was_running || buf_size != last_size || last_index >= buf_size)
+                last_index = index;
+            last_size = buf_size;
+            samples = (index + buf_size - last_index) % buf_size;
+
+            // the new span may wrap around the end of the buffer
+            u32_t first = buf_size - last_index;
+            if (first > samples)
+                first = samples;
+            memcpy(buf, mmap_area->buffer + last_index, first * sizeof(s16_t));
+            memcpy(buf + first, mmap_area->buffer, (samples - first) * sizeof(s16_t));
+            last_index = index;
+        }
+
+        pthread_rwlock_unlock(&mmap_area->rwlock);
+
         // audio rate may change between songs (e.g. 44.1kHz to 96kHz)
-        audio->rate = mmap_area->rate;
-        buf_frames = mmap_area->buf_size / 2;
-        // reread after the whole buffer has changed
-        req.tv_nsec = (1000000 / mmap_area->rate) * buf_frames;
-        if (mmap_area->running) {
-            // Frames are written by squeezelite to the buffer array starting from
-            // buffer[buf_index + 1], looping around the whole array.
-            // Thus, the starting position only affects the phase spectrum of the
-            // fft, and not the power spectrum, so we can just read in the
-            // whole buffer.
-            pthread_mutex_lock(&lock);
-            for (int i = 0; i < buf_frames / (fftw_frames * 2); i += fftw_frames * 2) {
-                for (int n = 0; n < fftw_frames * 2; n++) {
-                    buf[n] = mmap_area->buffer[n + i];
-                }
-                write_to_fftw_input_buffers(fftw_frames, buf, audio);
-            }
-            pthread_mutex_unlock(&lock);
-            nanosleep(&req, NULL);
+        if (rate)
+            __atomic_store_n(&audio->rate, rate, __ATOMIC_RELAXED);
+
+        if (running && rate) {
+            int frames = samples / 2;
+            write_frames_to_input_buffers(frames, buf, FORMAT_S16, audio);
+
+            // sleep until the next chunk should be there, a bit less if
+            // this read was late and found more than a chunk waiting
+            int sleep_frames = SHMEM_CHUNK_FRAMES;
+            if (frames > SHMEM_CHUNK_FRAMES)
+                sleep_frames = max(2 * SHMEM_CHUNK_FRAMES - frames, 0);
+            req.tv_nsec = (long)sleep_frames * 1000000000L / rate;
         } else {
-            write_to_fftw_input_buffers(fftw_frames, silence_buffer, audio);
-            nanosleep(&req, NULL);
+            if (was_running)
+                reset_output_buffers(audio);
+            req.tv_nsec = SHMEM_IDLE_NSEC;
         }
+        was_running = running && rate;
+
+        nanosleep(&req, NULL);
     }
 
     // cleanup
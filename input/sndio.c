@@ -7,7 +7,7 @@ void *input_sndio(void *data) {
     struct audio_data *audio = (struct audio_data *)data;
     struct sio_par par;
     struct sio_hdl *hdl;
-    int16_t buf[audio->FFTtreblebufferSize * 2];
+    int16_t buf[audio->block_frames * 2];
 
     sio_initpar(&par);
     par.sig = 1;
@@ -40,9 +40,7 @@ void *input_sndio(void *data) {
             exit(EXIT_FAILURE);
         }
 
-        pthread_mutex_lock(&lock);
         write_to_fftw_input_buffers(frames, buf, audio);
-        pthread_mutex_unlock(&lock);
     }
 
     sio_stop(hdl);
@@ -5,6 +5,7 @@ set -e
 # squeezelite -v -m 51:fb:32:f8:e6:9f -z
 # sudo modprobe snd-aloop
 # arecord -D hw:Loopback,1 -c 2 -r 44100 > /tmp/fifo &
+# head -c 352800 /dev/urandom > /tmp/cava_export_test.raw
 
 TESTCFGS="example_files/test_configs/*"
 for f in $TESTCFGS
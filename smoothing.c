@@ -0,0 +1,44 @@
+#include "smoothing.h"
+
+#include "util.h"
+
+int *monstercat_filter(int *bars, int number_of_bars, int waves, double monstercat) {
+
+    int z;
+
+    // process [smoothing]: monstercat-style "average"
+
+    if (waves > 0) {
+        for (z = 0; z < number_of_bars; z++) { // waves
+            bars[z] = bars[z] / 1.25;
+            // if (bars[z] < 1) bars[z] = 1;
+            // bars are never negative, so the parabola stops mattering once it
+            // drops below zero. that bounds the window to sqrt(bars[z]) either side.
+            for (int de = 1; de * de < bars[z]; de++) {
+                if (z - de >= 0)
+                    bars[z - de] = max(bars[z] - de * de, bars[z - de]);
+                if (z + de < number_of_bars)
+                    bars[z + de] = max(bars[z] - de * de, bars[z + de]);
+            }
+        }
+    } else if (monstercat > 0) {
+        // every bar is at least each other bar divided by monstercat to the power
+        // of their distance. one forward and one backward max-scan with a decaying
+        // carry give that envelope in linear time. the carry is only truncated
+        // when stored, where the quadratic loop truncated at every bar, so a bar
+        // can come out one higher than it did there.
+        double decay = 1 / monstercat;
+        double carry = 0;
+        for (z = 0; z < number_of_bars; z++) {
+            carry = max(carry * decay, (double)bars[z]);
+            bars[z] = carry;
+        }
+        carry = 0;
+        for (z = number_of_bars - 1; z >= 0; z--) {
+            carry = max(carry * decay, (double)bars[z]);
+            bars[z] = carry;
+        }
+    }
+
+    return bars;
+}
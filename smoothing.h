@@ -0,0 +1,7 @@
+#pragma once
+
+// [smoothing] filters, run on the bars in place before they are drawn. waves
+// spreads each bar into a downward parabola, monstercat makes every bar at least
+// each other bar divided by monstercat to the power of their distance. waves wins
+// when both are set. returns bars.
+int *monstercat_filter(int *bars, int number_of_bars, int waves, double monstercat);
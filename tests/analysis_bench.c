@@ -0,0 +1,201 @@
+// times one frame of the analysis path at 44.1 kHz and 60 fps, split into its
+// steps: a block of input into the ring, windowing, the FFTs, magnitudes and bar
+// sums. built by make check but not run by it, the numbers depend on the machine.
+// threads and bass_resolution are those of the config, the FFT sizes and the time
+// it took to plan them are printed first. the bar step is then timed again at
+// 100, 500 and 1024 bars, or only at 'bars' when given, against the loop it
+// replaced, which took the magnitude of each bin inside the loop over the bars.
+//
+//   ./tests/analysis_bench [frames] [threads] [bass_resolution] [bars]
+
+#include "fft.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#ifndef M_PI
+#define M_PI 3.1415926535897932385
+#endif
+
+#define RATE 44100
+#define BLOCK (RATE / 60)
+#define BARS 100 // what cava draws
+#define MAX_BARS 1024
+
+#ifdef FFT_FLOAT
+#define PRECISION "float"
+#define sample_hypot hypotf
+#else
+#define PRECISION "double"
+#define sample_hypot hypot
+#endif
+
+enum { STEP_INPUT, STEP_WINDOW, STEP_FFT, STEP_MAGNITUDE, STEP_BARS, STEPS };
+static const char *step_names[STEPS] = {"input", "window", "fft", "magnitude", "bars"};
+
+static double now_usec(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e6 + t.tv_nsec / 1e3;
+}
+
+static void run(const char *name, struct audio_data *audio, struct fft_bands *bands, bool stereo,
+                const int16_t *buf, int frames) {
+    // one bar per run of bins over the whole arena of a channel
+    int first[BARS], last[BARS];
+    sample_t weight[BARS];
+    int width = bands->channel_bins / BARS;
+    for (int n = 0; n < BARS; n++) {
+        first[n] = n * width;
+        last[n] = first[n] + width - 1;
+        weight[n] = 1.0 / width;
+    }
+    struct bar_table table = {.bars = BARS, .first = first, .last = last, .weight = weight};
+    sample_t bars[2][BARS];
+
+    double total[STEPS] = {0};
+    for (int frame = 0; frame < frames; frame++) {
+        double t[STEPS + 1];
+        t[0] = now_usec();
+        write_frames_to_input_buffers(BLOCK, buf + (frame % 60) * BLOCK * 2, FORMAT_S16, audio);
+        t[1] = now_usec();
+        prepare_fftw_input_buffers(audio);
+        t[2] = now_usec();
+        fft_execute(bands, stereo);
+        t[3] = now_usec();
+        fft_magnitudes(bands, stereo);
+        t[4] = now_usec();
+        fft_bar_sums(&table, bands->magnitude, bars[0]);
+        if (stereo)
+            fft_bar_sums(&table, bands->magnitude + bands->channel_bins, bars[1]);
+        t[5] = now_usec();
+
+        for (int i = 0; i < STEPS; i++)
+            total[i] += t[i + 1] - t[i];
+    }
+
+    double sum = 0;
+    printf("%-6s %-6s", PRECISION, name);
+    for (int i = 0; i < STEPS; i++) {
+        printf("  %s %6.2f", step_names[i], total[i] / frames);
+        sum += total[i] / frames;
+    }
+    printf("  total %7.2f us per frame\n", sum);
+}
+
+// bars spread logarithmically over the whole arena of a channel, averaged
+static void make_table(int bars, int bins, int *first, int *last, sample_t *weight) {
+    for (int n = 0; n < bars; n++) {
+        first[n] = 1 + (int)((bins - 2) * (pow(2, 12.0 * n / bars) - 1) / 4095);
+        last[n] = 1 + (int)((bins - 2) * (pow(2, 12.0 * (n + 1) / bars) - 1) / 4095) - 1;
+        if (last[n] < first[n])
+            last[n] = first[n];
+        weight[n] = 1.0 / (last[n] - first[n] + 1);
+    }
+}
+
+// the stereo bars of the last spectrum, the way cava made them before the bar table
+static void old_bar_loop(const struct bar_table *table, const struct fft_bands *bands,
+                         sample_t *out_l, sample_t *out_r) {
+    const FFTW(complex) *spectrum_l = bands->spectrum;
+    const FFTW(complex) *spectrum_r = bands->spectrum + bands->channel_bins;
+    for (int n = 0; n < table->bars; n++) {
+        out_l[n] = 0;
+        out_r[n] = 0;
+        for (int i = table->first[n]; i <= table->last[n]; i++) {
+            out_l[n] += sample_hypot(spectrum_l[i][0], spectrum_l[i][1]);
+            out_r[n] += sample_hypot(spectrum_r[i][0], spectrum_r[i][1]);
+        }
+        out_l[n] /= table->last[n] - table->first[n] + 1;
+        out_r[n] /= table->last[n] - table->first[n] + 1;
+    }
+}
+
+// the magnitude and bar steps of a stereo frame, the old loop against the table
+static void compare_bars(struct fft_bands *bands, int bars, int frames) {
+    int first[MAX_BARS], last[MAX_BARS];
+    sample_t weight[MAX_BARS];
+    make_table(bars, bands->channel_bins, first, last, weight);
+    struct bar_table table = {.bars = bars, .first = first, .last = last, .weight = weight};
+    sample_t old[2][MAX_BARS], new[2][MAX_BARS];
+
+    double start = now_usec();
+    for (int frame = 0; frame < frames; frame++)
+        old_bar_loop(&table, bands, old[0], old[1]);
+    double old_usec = (now_usec() - start) / frames;
+
+    start = now_usec();
+    for (int frame = 0; frame < frames; frame++) {
+        fft_magnitudes(bands, true);
+        fft_bar_sums(&table, bands->magnitude, new[0]);
+        fft_bar_sums(&table, bands->magnitude + bands->channel_bins, new[1]);
+    }
+    double new_usec = (now_usec() - start) / frames;
+
+    double loudest = 0, worst = 0;
+    for (int i = 0; i < 2 * bars; i++)
+        loudest = fmax(loudest, old[i / bars][i % bars]);
+    for (int i = 0; i < 2 * bars; i++)
+        worst = fmax(worst, fabs(new[i / bars][i % bars] - old[i / bars][i % bars]) / loudest);
+
+    printf("%-6s %4d bars  old loop %7.2f us  table %7.2f us  largest difference %.1e\n",
+           PRECISION, bars, old_usec, new_usec, worst);
+}
+
+int main(int argc, char **argv) {
+    int frames = argc > 1 ? atoi(argv[1]) : 6000;
+    int threads = argc > 2 ? atoi(argv[2]) : 1;
+    int bass_resolution = argc > 3 ? atoi(argv[3]) : BASS_RESOLUTION_HZ;
+    int bars = argc > 4 ? atoi(argv[4]) : 0;
+    if (bars < 0 || bars > MAX_BARS) {
+        fprintf(stderr, "bars must be between 1 and %d\n", MAX_BARS);
+        return 1;
+    }
+
+    // keep fftw wisdom out of the user's cache, every run plans from scratch
+    unsetenv("XDG_CACHE_HOME");
+    unsetenv("HOME");
+    fft_init(false, false, threads, bass_resolution);
+
+    struct audio_data audio = {.channels = 2, .ring_size = 2 * FFT_MAX_SIZE};
+    audio.ring_l = FFTW(alloc_real)(audio.ring_size);
+    audio.ring_r = FFTW(alloc_real)(audio.ring_size);
+
+    // a second of input, looped
+    int16_t *buf = malloc(sizeof(int16_t) * 2 * 60 * BLOCK);
+    uint32_t seed = 1;
+    for (int i = 0; i < 60 * BLOCK; i++) {
+        seed = seed * 1664525 + 1013904223;
+        buf[i * 2] = 8000 * sin(2 * M_PI * 60 * i / RATE) + (int)(seed >> 20) - 2048;
+        buf[i * 2 + 1] = 6000 * sin(2 * M_PI * 110 * i / RATE) + (int)(seed >> 20) - 2048;
+    }
+
+    struct fft_bands bands;
+    double planning_ms = fft_select_bands(&bands, &audio, RATE);
+    printf("FFT sizes %d, %d, %d on up to %d threads, planned in %.0f ms\n", bands.bass->size,
+           bands.mid->size, bands.treble->size, threads, planning_ms);
+
+    run("mono", &audio, &bands, false, buf, frames);
+    run("stereo", &audio, &bands, true, buf, frames);
+
+    // the spectrum of the last stereo frame stays in the arena for this
+    if (bars) {
+        compare_bars(&bands, bars, frames);
+    } else {
+        compare_bars(&bands, 100, frames);
+        compare_bars(&bands, 500, frames);
+        compare_bars(&bands, 1024, frames);
+    }
+
+    fft_init(false, true, threads, bass_resolution);
+    fft_select_bands(&bands, &audio, RATE);
+    run("packed", &audio, &bands, true, buf, frames);
+
+    fft_free_bands();
+    FFTW(free)(audio.ring_l);
+    FFTW(free)(audio.ring_r);
+    free(buf);
+    return 0;
+}
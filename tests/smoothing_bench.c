@@ -0,0 +1,65 @@
+// times the smoothing filters against the quadratic loops they replaced, on
+// random bars at 100, 500 and 1024 bars, or only at 'bars' when given. built by
+// make check but not run by it, the numbers depend on the machine. monstercat is
+// the config value, cava runs the filter at 1.5 times that.
+//
+//   ./tests/smoothing_bench [runs] [monstercat] [bars]
+
+#include "smoothing.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "tests/smoothing_reference.h"
+
+#define MAX_BARS 1024
+
+static double now_usec(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e6 + t.tv_nsec / 1e3;
+}
+
+// mean time of one call on fresh random bars, the same bars for both filters
+static void run(const char *name, int number_of_bars, int waves, double monstercat, int runs) {
+    static int bars[MAX_BARS];
+    double old_usec = 0, new_usec = 0;
+
+    for (int run = 0; run < runs; run++) {
+        uint32_t seed = run + 1;
+        make_bars(bars, number_of_bars, &seed);
+        double start = now_usec();
+        reference_monstercat_filter(bars, number_of_bars, waves, monstercat);
+        old_usec += now_usec() - start;
+
+        seed = run + 1;
+        make_bars(bars, number_of_bars, &seed);
+        start = now_usec();
+        monstercat_filter(bars, number_of_bars, waves, monstercat);
+        new_usec += now_usec() - start;
+    }
+
+    printf("%4d bars  %-10s  old %9.1f us  new %7.1f us per call\n", number_of_bars, name,
+           old_usec / runs, new_usec / runs);
+}
+
+int main(int argc, char **argv) {
+    int runs = argc > 1 ? atoi(argv[1]) : 100;
+    double monstercat = 1.5 * (argc > 2 ? atof(argv[2]) : 1.5);
+    int bars = argc > 3 ? atoi(argv[3]) : 0;
+    if (runs < 1 || monstercat <= 0 || bars < 0 || bars > MAX_BARS) {
+        fprintf(stderr, "usage: %s [runs] [monstercat] [bars up to %d]\n", argv[0], MAX_BARS);
+        return 1;
+    }
+
+    static const int bar_counts[] = {100, 500, 1024};
+    for (int i = 0; i < 3; i++) {
+        int count = bars ? bars : bar_counts[i];
+        run("monstercat", count, 0, monstercat, runs);
+        run("waves", count, 1, 0, runs);
+        if (bars)
+            break;
+    }
+    return 0;
+}
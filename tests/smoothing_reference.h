@@ -0,0 +1,47 @@
+// the smoothing filters as cava had them before they were made linear, quadratic
+// in the number of bars. kept to check and time the current ones against.
+
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+
+#include "util.h"
+
+static int *reference_monstercat_filter(int *bars, int number_of_bars, int waves,
+                                        double monstercat) {
+    int m_y, de;
+    if (waves > 0) {
+        for (int z = 0; z < number_of_bars; z++) {
+            bars[z] = bars[z] / 1.25;
+            for (m_y = z - 1; m_y >= 0; m_y--) {
+                de = z - m_y;
+                bars[m_y] = max(bars[z] - pow(de, 2), bars[m_y]);
+            }
+            for (m_y = z + 1; m_y < number_of_bars; m_y++) {
+                de = m_y - z;
+                bars[m_y] = max(bars[z] - pow(de, 2), bars[m_y]);
+            }
+        }
+    } else if (monstercat > 0) {
+        for (int z = 0; z < number_of_bars; z++) {
+            for (m_y = z - 1; m_y >= 0; m_y--) {
+                de = z - m_y;
+                bars[m_y] = max(bars[z] / pow(monstercat, de), bars[m_y]);
+            }
+            for (m_y = z + 1; m_y < number_of_bars; m_y++) {
+                de = m_y - z;
+                bars[m_y] = max(bars[z] / pow(monstercat, de), bars[m_y]);
+            }
+        }
+    }
+    return bars;
+}
+
+// random bars from 0 to 8000 high
+static void make_bars(int *bars, int number_of_bars, uint32_t *seed) {
+    for (int n = 0; n < number_of_bars; n++) {
+        *seed = *seed * 1664525 + 1013904223;
+        bars[n] = (*seed >> 8) % 8001;
+    }
+}
@@ -0,0 +1,56 @@
+// checks the smoothing filters against the quadratic loops they replaced, on
+// random bars. waves must come out the same, monstercat within one of the old
+// filter, which truncated its carry at every bar. run by make check.
+
+#include "smoothing.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "tests/smoothing_reference.h"
+
+#define MAX_BARS 1024
+
+// runs of each bar count, fewer where the old filter is slow
+static const int bar_counts[] = {100, 500, 1024};
+static const int runs[] = {100, 40, 10};
+
+static int check(const char *name, int waves, double monstercat, int tolerance) {
+    static int bars[MAX_BARS], expected[MAX_BARS];
+    uint32_t seed = 1;
+    long total = 0, differing = 0;
+    int worst = 0;
+
+    for (int i = 0; i < 3; i++) {
+        for (int run = 0; run < runs[i]; run++) {
+            make_bars(bars, bar_counts[i], &seed);
+            for (int n = 0; n < bar_counts[i]; n++)
+                expected[n] = bars[n];
+            monstercat_filter(bars, bar_counts[i], waves, monstercat);
+            reference_monstercat_filter(expected, bar_counts[i], waves, monstercat);
+
+            for (int n = 0; n < bar_counts[i]; n++) {
+                int difference = abs(bars[n] - expected[n]);
+                worst = max(worst, difference);
+                differing += difference != 0;
+            }
+            total += bar_counts[i];
+        }
+    }
+
+    bool ok = worst <= tolerance;
+    printf("%-4s %-10s %5.3f: %ld of %ld bars differ, by at most %d\n", ok ? "ok" : "FAIL", name,
+           monstercat, differing, total, worst);
+    return !ok;
+}
+
+int main(void) {
+    int failures = 0;
+    failures += check("waves", 1, 0, 0);
+    // the config values 1.05, 1.5 and 3, which cava scales by 1.5
+    failures += check("monstercat", 0, 1.05 * 1.5, 1);
+    failures += check("monstercat", 0, 1.5 * 1.5, 1);
+    failures += check("monstercat", 0, 3 * 1.5, 1);
+    return failures ? 1 : 0;
+}